@@ -0,0 +1,83 @@
+// Microbenchmark: line splitting with globalvar::build_line_match_pattern() (std::regex),
+// a byte-by-byte loop and newline_scan::find_line_ends.
+// Build with -DCLITHEME_BUILD_BENCH=ON and run ./newline_bench [size in MB].
+#include "globalvar.hpp"
+#include "newline_scan.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace clitheme;
+
+// Terminal-like text: lines of 0-160 printable bytes, mostly "\n" endings
+static std::string make_input(size_t size) {
+    std::mt19937 rng(42);
+    std::string text;
+    text.reserve(size + 256);
+    while (text.size() < size) {
+        size_t length = rng() % 160;
+        for (size_t i = 0; i < length; i++) text += static_cast<char>(' ' + rng() % 95);
+        const auto& nl = globalvar::newlines[rng() % 16 < 12 ? 2 : rng() % globalvar::newlines.size()];
+        text += nl;
+    }
+    return text;
+}
+
+static std::vector<size_t> split_regex(const std::string& text) {
+    static const std::regex line_match(globalvar::build_line_match_pattern());
+    std::vector<size_t> ends;
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), line_match); it != std::sregex_iterator(); ++it) {
+        if (it->length(1) > 0) ends.push_back(static_cast<size_t>(it->position(0) + it->length(0)));
+    }
+    return ends;
+}
+
+static std::vector<size_t> split_loop(const std::string& text) {
+    std::vector<size_t> ends;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (!newline_scan::is_newline_byte(c)) continue;
+        if (c == '\r' && i + 1 < text.size() && text[i + 1] == '\n') i++;
+        ends.push_back(i + 1);
+    }
+    return ends;
+}
+
+static std::vector<size_t> split_simd(const std::string& text) {
+    std::vector<size_t> ends;
+    newline_scan::find_line_ends(text.data(), text.size(), ends);
+    return ends;
+}
+
+template <typename F>
+static std::vector<size_t> run(const char* name, const std::string& text, int repeat, F&& split) {
+    std::vector<size_t> result;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; i++) result = split(text);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double mb = static_cast<double>(text.size()) * repeat / (1024.0 * 1024.0);
+    std::cout << name << ": " << mb / seconds << " MB/s (" << result.size() << " lines)\n";
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    std::string text = make_input(megabytes * 1024 * 1024);
+    // std::regex is orders of magnitude slower; give it a smaller sample
+    std::string sample = text.substr(0, std::min<size_t>(text.size(), 1024 * 1024));
+    sample = sample.substr(0, sample.find_last_of('\n') + 1);
+
+    std::cout << "newline_scan implementation: " << newline_scan::implementation() << "\n";
+    auto expected = run("std::regex (1 MB)", sample, 1, split_regex);
+    auto simd_sample = split_simd(sample);
+    auto loop = run("byte loop", text, 5, split_loop);
+    auto simd = run("newline_scan", text, 5, split_simd);
+
+    bool same = expected == simd_sample && loop == simd;
+    std::cout << (same ? "results match\n" : "RESULTS DIFFER\n");
+    return same ? 0 : 1;
+}
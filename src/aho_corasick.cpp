@@ -0,0 +1,114 @@
+#include "aho_corasick.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace clitheme {
+
+// Largest transition table built (entries); bigger automatons use the failure links
+static constexpr size_t max_dfa_entries = 4 * 1024 * 1024;
+
+AhoCorasick::AhoCorasick() : class_count_(0), built_(false) {
+    nodes_.emplace_back();
+    root_next_.fill(0);
+    byte_class_.fill(0);
+}
+
+int32_t AhoCorasick::find_edge(int32_t state, unsigned char c) const {
+    const auto& edges = nodes_[state].edges;
+    auto it = std::lower_bound(edges.begin(), edges.end(), c,
+        [](const std::pair<unsigned char, int32_t>& e, unsigned char b) { return e.first < b; });
+    return (it != edges.end() && it->first == c) ? it->second : -1;
+}
+
+size_t AhoCorasick::add(const std::string& pattern) {
+    assert(!built_ && "add() after build()");
+    assert(!pattern.empty() && "Empty pattern");
+    int32_t state = 0;
+    for (char ch : pattern) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        int32_t next = find_edge(state, c);
+        if (next < 0) {
+            next = static_cast<int32_t>(nodes_.size());
+            nodes_.emplace_back();
+            nodes_.back().depth = nodes_[state].depth + 1;
+            auto& edges = nodes_[state].edges;
+            auto it = std::lower_bound(edges.begin(), edges.end(), c,
+                [](const std::pair<unsigned char, int32_t>& e, unsigned char b) { return e.first < b; });
+            edges.insert(it, std::make_pair(c, next));
+        }
+        state = next;
+    }
+    if (!nodes_[state].outputs.empty()) return nodes_[state].outputs.front();
+    uint32_t id = static_cast<uint32_t>(pattern_lengths_.size());
+    nodes_[state].outputs.push_back(id);
+    pattern_lengths_.push_back(pattern.size());
+    return id;
+}
+
+void AhoCorasick::build() {
+    // Breadth-first: a node's failure link points to a shallower node
+    std::vector<int32_t> order;
+    order.reserve(nodes_.size());
+    for (const auto& edge : nodes_[0].edges) {
+        root_next_[edge.first] = edge.second;
+        nodes_[edge.second].fail = 0;
+        order.push_back(edge.second);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        int32_t state = order[i];
+        for (const auto& edge : nodes_[state].edges) {
+            int32_t child = edge.second;
+            nodes_[child].fail = next_state(nodes_[state].fail, edge.first);
+            int32_t fail = nodes_[child].fail;
+            nodes_[child].output_link = nodes_[fail].outputs.empty() ? nodes_[fail].output_link : fail;
+            order.push_back(child);
+        }
+    }
+
+    first_output_.resize(nodes_.size());
+    for (size_t state = 0; state < nodes_.size(); state++) {
+        first_output_[state] = nodes_[state].outputs.empty() ? nodes_[state].output_link : static_cast<int32_t>(state);
+    }
+
+    // Byte classes: one per byte used in a pattern, plus class 0 for all others
+    std::array<bool, 256> used{};
+    for (const auto& node : nodes_) {
+        for (const auto& edge : node.edges) used[edge.first] = true;
+    }
+    class_count_ = 1;
+    for (int c = 0; c < 256; c++) byte_class_[c] = used[c] ? static_cast<uint8_t>(class_count_++) : 0;
+    if (class_count_ > 256) class_count_ = 0; // Every byte used: no room for class 0 in uint8_t
+
+    // Transition table, filled in breadth-first order so that failure states are done first
+    if (class_count_ > 0 && nodes_.size() * class_count_ <= max_dfa_entries) {
+        std::vector<unsigned char> representative(class_count_, 0);
+        for (int c = 255; c >= 0; c--) representative[byte_class_[c]] = static_cast<unsigned char>(c);
+        dfa_.assign(nodes_.size() * class_count_, 0);
+        for (size_t cls = 1; cls < class_count_; cls++) dfa_[cls] = root_next_[representative[cls]];
+        for (int32_t state : order) {
+            size_t row = static_cast<size_t>(state) * class_count_;
+            size_t fail_row = static_cast<size_t>(nodes_[state].fail) * class_count_;
+            for (size_t cls = 1; cls < class_count_; cls++) {
+                int32_t next = find_edge(state, representative[cls]);
+                dfa_[row + cls] = next >= 0 ? next : dfa_[fail_row + cls];
+            }
+        }
+    }
+    built_ = true;
+}
+
+std::vector<bool> AhoCorasick::find_present(const std::string& text) const {
+    std::vector<bool> present(pattern_count(), false);
+    size_t remaining = pattern_count();
+    if (remaining == 0) return present;
+    scan(text, 0, text.size(), [&](uint32_t id, size_t) {
+        if (!present[id]) {
+            present[id] = true;
+            remaining--;
+        }
+        return remaining > 0;
+    });
+    return present;
+}
+
+} // namespace clitheme
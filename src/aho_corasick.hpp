@@ -0,0 +1,90 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace clitheme {
+
+// Aho-Corasick automaton: finds occurrences of many literal byte strings
+// in a single pass over the text.
+class AhoCorasick {
+public:
+    AhoCorasick();
+
+    // Add a non-empty pattern; returns its id (identical patterns share one id).
+    // Must be called before build().
+    size_t add(const std::string& pattern);
+    // Compute failure and output links
+    void build();
+
+    size_t pattern_count() const { return pattern_lengths_.size(); }
+    size_t pattern_length(size_t id) const { return pattern_lengths_[id]; }
+    bool empty() const { return pattern_lengths_.empty(); }
+
+    // Call on_match(pattern_id, end_offset) for every occurrence, overlapping ones
+    // included, that lies completely inside text[begin, end). Occurrences are
+    // reported in order of their end offset. on_match returns false to stop scanning.
+    template <typename Callback>
+    void scan(const std::string& text, size_t begin, size_t end, Callback&& on_match) const {
+        int32_t state = 0;
+        for (size_t pos = begin; pos < end; pos++) {
+            unsigned char c = static_cast<unsigned char>(text[pos]);
+            state = dfa_.empty() ? next_state(state, c) : dfa_[static_cast<size_t>(state) * class_count_ + byte_class_[c]];
+            for (int32_t s = first_output_[state]; s > 0; s = nodes_[s].output_link) {
+                for (uint32_t id : nodes_[s].outputs) {
+                    if (!on_match(id, pos + 1)) return;
+                }
+            }
+        }
+    }
+
+    // Which patterns occur anywhere in text (indexed by pattern id)
+    std::vector<bool> find_present(const std::string& text) const;
+
+    // Length of the longest suffix of text[begin, end) that is a prefix of a pattern:
+    // where an occurrence that more text could complete would start (the state at end)
+    size_t prefix_suffix_length(const std::string& text, size_t begin, size_t end) const {
+        int32_t state = 0;
+        for (size_t pos = begin; pos < end; pos++) {
+            unsigned char c = static_cast<unsigned char>(text[pos]);
+            state = dfa_.empty() ? next_state(state, c) : dfa_[static_cast<size_t>(state) * class_count_ + byte_class_[c]];
+        }
+        return nodes_[state].depth;
+    }
+
+private:
+    struct Node {
+        std::vector<std::pair<unsigned char, int32_t>> edges; // Sorted by byte
+        int32_t fail = 0;
+        int32_t output_link = 0; // Nearest suffix state with outputs (0 = none)
+        uint32_t depth = 0;      // Length of the prefix the state stands for
+        std::vector<uint32_t> outputs;
+    };
+
+    int32_t find_edge(int32_t state, unsigned char c) const;
+    int32_t next_state(int32_t state, unsigned char c) const {
+        while (state != 0) {
+            int32_t next = find_edge(state, c);
+            if (next >= 0) return next;
+            state = nodes_[state].fail;
+        }
+        return root_next_[c];
+    }
+
+    std::vector<Node> nodes_;
+    std::array<int32_t, 256> root_next_;
+    // Per state: the state itself if it has outputs, else its output_link
+    std::vector<int32_t> first_output_;
+    // Full transition table (state * class_count_ + byte class), if small enough;
+    // bytes that occur in no pattern share one class
+    std::vector<int32_t> dfa_;
+    std::array<uint8_t, 256> byte_class_;
+    size_t class_count_;
+    std::vector<size_t> pattern_lengths_;
+    bool built_;
+};
+
+} // namespace clitheme
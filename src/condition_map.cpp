@@ -0,0 +1,65 @@
+#include "condition_map.hpp"
+#include <algorithm>
+
+namespace clitheme {
+
+bool ConditionMap::overlaps(const std::vector<Interval>& intervals, size_t begin, size_t end) {
+    if (begin >= end) return false;
+    // First interval ending after begin
+    auto it = std::upper_bound(intervals.begin(), intervals.end(), begin,
+        [](size_t pos, const Interval& iv) { return pos < iv.end; });
+    return it != intervals.end() && it->start < end;
+}
+
+// Append [start, end) to intervals, merging with an adjacent previous interval
+static void push_interval(std::vector<ConditionMap::Interval>& intervals, size_t start, size_t end) {
+    if (start >= end) return;
+    if (!intervals.empty() && intervals.back().end == start) {
+        intervals.back().end = end;
+    } else {
+        intervals.push_back(ConditionMap::Interval{start, end});
+    }
+}
+
+std::vector<ConditionMap::Interval> ConditionMap::remap(const std::vector<Interval>& intervals,
+                                                        const EditList& edits, bool add_replacements) {
+    // The source is split into kept segments between edits; segment k is
+    // [previous edit end, edit k offset) and is followed by the replacement of edit k
+    std::vector<Interval> result;
+    result.reserve(intervals.size() + (add_replacements ? edits.edits().size() : 0));
+    size_t i = 0;
+    size_t seg_start = 0;
+    long long delta = 0; // new position - old position within the current segment
+    const auto& edit_list = edits.edits();
+    for (size_t k = 0; k <= edit_list.size(); k++) {
+        bool last = k == edit_list.size();
+        size_t seg_end = last ? static_cast<size_t>(-1) : edit_list[k].offset;
+
+        // Intersect the intervals with the kept segment
+        while (i < intervals.size() && intervals[i].start < seg_end) {
+            size_t a = std::max(intervals[i].start, seg_start);
+            size_t b = std::min(intervals[i].end, seg_end);
+            if (a < b) push_interval(result, a + delta, b + delta);
+            if (intervals[i].end > seg_end) break; // Continues in a later segment
+            i++;
+        }
+        if (last) break;
+
+        const auto& edit = edit_list[k];
+        size_t new_offset = edit.offset + delta;
+        if (add_replacements) push_interval(result, new_offset, new_offset + edit.replacement.size());
+        delta += static_cast<long long>(edit.replacement.size()) - static_cast<long long>(edit.length);
+        seg_start = edit.offset + edit.length;
+        // Skip intervals that lie entirely inside the replaced range
+        while (i < intervals.size() && intervals[i].end <= seg_start) i++;
+    }
+    return result;
+}
+
+void ConditionMap::apply(const EditList& edits, bool end_match_here) {
+    if (edits.empty()) return;
+    matched_ = remap(matched_, edits, !end_match_here);
+    end_match_ = remap(end_match_, edits, end_match_here);
+}
+
+} // namespace clitheme
@@ -0,0 +1,45 @@
+#pragma once
+#include "edit_list.hpp"
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+
+// Tracks which byte ranges of the content were produced by substitutions:
+// "matched" ranges and "end match here" ranges (from endmatchhere rules).
+// Ranges are kept as sorted, non-overlapping intervals per kind, so memory and
+// time scale with the number of matches rather than with the content size.
+class ConditionMap {
+public:
+    struct Interval {
+        size_t start;
+        size_t end; // exclusive
+    };
+
+    // Forget all ranges
+    void clear() { matched_.clear(); end_match_.clear(); }
+
+    // Whether [begin, end) overlaps an "end match here" range; O(log n)
+    bool has_end_match(size_t begin, size_t end) const { return overlaps(end_match_, begin, end); }
+    // Whether [begin, end) overlaps any range; O(log n)
+    bool has_any(size_t begin, size_t end) const {
+        return overlaps(matched_, begin, end) || overlaps(end_match_, begin, end);
+    }
+
+    // Move the ranges along with the edits (dropping the replaced parts) and add the
+    // replacements of the edits as new ranges; end_match_here selects their kind
+    void apply(const EditList& edits, bool end_match_here);
+
+    const std::vector<Interval>& matched() const { return matched_; }
+    const std::vector<Interval>& end_match() const { return end_match_; }
+
+private:
+    static bool overlaps(const std::vector<Interval>& intervals, size_t begin, size_t end);
+    static std::vector<Interval> remap(const std::vector<Interval>& intervals, const EditList& edits,
+                                       bool add_replacements);
+
+    std::vector<Interval> matched_;
+    std::vector<Interval> end_match_;
+};
+
+} // namespace clitheme
@@ -74,10 +74,20 @@ void init_db(const std::string& file_path) {
         "end_match_here INTEGER NOT NULL,"
         "stdout_stderr_only INTEGER NOT NULL,"
         "unique_id TEXT NOT NULL,"
-        "file_id TEXT NOT NULL"
+        "file_id TEXT NOT NULL,"
+        "effective_command_basename TEXT,"
+        "required_literal BLOB,"
+        "ignore_escapes INTEGER NOT NULL"
         ");";
     exec_sql(create_sql);
 
+    // Index for per-entry locale lookups in get_matches
+    exec_sql("CREATE INDEX " + globalvar::db_data_tablename + "_id_locale ON " +
+             globalvar::db_data_tablename + " (unique_id, effective_locale);");
+    // Index for selecting only the rules of the target command in get_matches
+    exec_sql("CREATE INDEX " + globalvar::db_data_tablename + "_command_basename ON " +
+             globalvar::db_data_tablename + " (effective_command_basename);");
+
     // Create version table
     exec_sql("CREATE TABLE " + globalvar::db_data_tablename + "_version (value INTEGER NOT NULL);");
 
@@ -141,6 +151,13 @@ static std::string normalize_command(const std::string& cmd) {
     return string_utils::strip(result);
 }
 
+std::string command_basename(const std::string& first_phrase) {
+    std::string basename = fs::path(first_phrase).filename().string();
+    // Remove common extensions
+    static const std::regex ext_re(R"((\.(exe|com|ps1|bat|sh))$)");
+    return std::regex_replace(basename, ext_re, "");
+}
+
 void add_subst_entry(
     const std::string& match_pattern,
     const std::string& substitute_pattern,
@@ -156,7 +173,8 @@ void add_subst_entry(
     const std::string& unique_id,
     const std::string& file_id,
     const std::string& line_number_debug,
-    std::function<void(const std::string&)> warning_handler
+    std::function<void(const std::string&)> warning_handler,
+    bool ignore_escapes
 ) {
     assert(connection != nullptr && "No active database connection");
 
@@ -170,6 +188,9 @@ void add_subst_entry(
         catch (const std::exception& e) { throw bad_pattern(e.what()); }
     }
 
+    // Literal every match must contain; lets exec skip rules that cannot match a chunk
+    std::optional<std::string> required_literal = pcre2_regex::required_literal(match_pattern);
+
     std::string locale_condition = effective_locale.has_value()
         ? "effective_locale=?"
         : "typeof(effective_locale)=typeof(?)";
@@ -243,12 +264,20 @@ void add_subst_entry(
             sqlite3_finalize(stmt);
         }
 
+        // Normalized first phrase of the command filter (not for regex filters)
+        std::optional<std::string> cmd_basename;
+        if (cmd.has_value() && !command_is_regex) {
+            auto cmd_parts = string_utils::split_whitespace(*cmd);
+            if (!cmd_parts.empty()) cmd_basename = command_basename(cmd_parts[0]);
+        }
+
         // Insert new entry
         std::string insert_sql = "INSERT INTO " + globalvar::db_data_tablename +
             " (match_pattern, match_is_multiline, substitute_pattern, is_regex,"
             " effective_locale, effective_command, command_match_strictness, command_is_regex,"
-            " foreground_only, end_match_here, stdout_stderr_only, unique_id, file_id)"
-            " VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?);";
+            " foreground_only, end_match_here, stdout_stderr_only, unique_id, file_id,"
+            " effective_command_basename, required_literal, ignore_escapes)"
+            " VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);";
 
         sqlite3_prepare_v2(connection, insert_sql.c_str(), -1, &stmt, nullptr);
         idx = 1;
@@ -271,6 +300,16 @@ void add_subst_entry(
         sqlite3_bind_int(stmt, idx++, stdout_stderr_matchoption);
         sqlite3_bind_text(stmt, idx++, unique_id.c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_text(stmt, idx++, file_id.c_str(), -1, SQLITE_TRANSIENT);
+        if (cmd_basename.has_value())
+            sqlite3_bind_text(stmt, idx++, cmd_basename->c_str(), -1, SQLITE_TRANSIENT);
+        else
+            sqlite3_bind_null(stmt, idx++);
+        if (required_literal.has_value())
+            sqlite3_bind_blob(stmt, idx++, required_literal->data(),
+                              static_cast<int>(required_literal->size()), SQLITE_TRANSIENT);
+        else
+            sqlite3_bind_null(stmt, idx++);
+        sqlite3_bind_int(stmt, idx++, ignore_escapes ? 1 : 0);
         sqlite3_step(stmt);
         sqlite3_finalize(stmt);
     }
@@ -296,6 +335,11 @@ static Item row_to_item(sqlite3_stmt* stmt) {
     item.stdout_stderr_only = sqlite3_column_int(stmt, 10);
     item.unique_id = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 11));
     item.file_id = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 12));
+    if (sqlite3_column_type(stmt, 13) != SQLITE_NULL) {
+        const char* literal = static_cast<const char*>(sqlite3_column_blob(stmt, 13));
+        item.required_literal = std::string(literal, sqlite3_column_bytes(stmt, 13));
+    }
+    item.ignore_escapes = sqlite3_column_int(stmt, 14) != 0;
     return item;
 }
 
@@ -307,14 +351,8 @@ bool check_command(const std::string& match_cmd, int strictness, const std::stri
     // Valid first phrases: full path, basename, basename without extension
     std::vector<std::string> valid_first_phrases;
     valid_first_phrases.push_back(first_phrase);
-    {
-        fs::path p(first_phrase);
-        std::string basename = p.filename().string();
-        valid_first_phrases.push_back(basename);
-        // Remove common extensions
-        std::string no_ext = std::regex_replace(basename, std::regex(R"((\.(exe|com|ps1|bat|sh))$)"), "");
-        valid_first_phrases.push_back(no_ext);
-    }
+    valid_first_phrases.push_back(fs::path(first_phrase).filename().string());
+    valid_first_phrases.push_back(command_basename(first_phrase));
 
     if (is_regex_mode) {
         for (const auto& fp : valid_first_phrases) {
@@ -397,74 +435,87 @@ bool check_command(const std::string& match_cmd, int strictness, const std::stri
 }
 
 // Internal: get matches from database for a command
+// A single query picks, for every unique_id, the rows of the best available locale
+// (locales from get_locale() in order, then the default NULL locale), keeping rule order.
+// Only rows whose command filter can apply to the command are read; check_command
+// does the exact filtering afterwards.
 static std::vector<Item> get_matches(const std::optional<std::string>& command) {
     assert(connection != nullptr);
 
     auto locales = locale_detect::get_locale();
     std::vector<Item> match_items;
 
-    // Get all unique entry IDs
-    std::string sql = "SELECT DISTINCT unique_id FROM " + globalvar::db_data_tablename;
-    sqlite3_stmt* id_stmt;
-    sqlite3_prepare_v2(connection, sql.c_str(), -1, &id_stmt, nullptr);
-
-    std::vector<std::string> entry_ids;
-    while (sqlite3_step(id_stmt) == SQLITE_ROW) {
-        entry_ids.push_back(reinterpret_cast<const char*>(sqlite3_column_text(id_stmt, 0)));
+    // Basenames a matching filter can have: those of the valid first phrases in check_command
+    std::vector<std::string> command_basenames;
+    if (command.has_value()) {
+        auto target_parts = string_utils::split_whitespace(*command);
+        if (!target_parts.empty()) {
+            std::string base = command_basename(target_parts[0]);
+            command_basenames.push_back(base);
+            std::string base_of_base = command_basename(base);
+            if (base_of_base != base) command_basenames.push_back(base_of_base);
+        }
+    }
+    std::string command_condition;
+    if (command.has_value()) {
+        command_condition = " WHERE (effective_command_basename IS NULL";
+        if (!command_basenames.empty()) {
+            command_condition += " OR effective_command_basename IN (?";
+            for (size_t i = 1; i < command_basenames.size(); i++) command_condition += ", ?";
+            command_condition += ")";
+        }
+        command_condition += ")";
     }
-    sqlite3_finalize(id_stmt);
 
     // Column list
     std::string columns = "match_pattern, match_is_multiline, substitute_pattern, is_regex,"
         " effective_locale, effective_command, command_match_strictness, command_is_regex,"
-        " foreground_only, end_match_here, stdout_stderr_only, unique_id, file_id";
-
-    for (const auto& eid : entry_ids) {
-        bool fetched = false;
-        // Try locales in order, then default (null)
-        std::vector<std::optional<std::string>> locale_list;
-        for (const auto& l : locales) locale_list.push_back(l);
-        locale_list.push_back(std::nullopt); // "default" locale
-
-        for (const auto& locale : locale_list) {
-            if (fetched) break;
-
-            std::string locale_condition = locale.has_value()
-                ? "effective_locale=?"
-                : "typeof(effective_locale)=typeof(?)";
-
-            std::string fetch_sql = "SELECT " + columns + " FROM " + globalvar::db_data_tablename +
-                " WHERE unique_id=? AND " + locale_condition + ";";
-
-            sqlite3_stmt* stmt;
-            sqlite3_prepare_v2(connection, fetch_sql.c_str(), -1, &stmt, nullptr);
-            sqlite3_bind_text(stmt, 1, eid.c_str(), -1, SQLITE_TRANSIENT);
-            if (locale.has_value())
-                sqlite3_bind_text(stmt, 2, locale->c_str(), -1, SQLITE_TRANSIENT);
-            else
-                sqlite3_bind_null(stmt, 2);
+        " foreground_only, end_match_here, stdout_stderr_only, unique_id, file_id,"
+        " required_literal, ignore_escapes";
 
-            std::vector<Item> fetches;
-            while (sqlite3_step(stmt) == SQLITE_ROW) {
-                fetches.push_back(row_to_item(stmt));
-            }
-            sqlite3_finalize(stmt);
+    // Ranked locale candidates: (?, 0), (?, 1), ..., (NULL, n)
+    std::string locale_values;
+    for (size_t i = 0; i < locales.size(); i++) {
+        locale_values += "(?, " + std::to_string(i) + "), ";
+    }
+    locale_values += "(NULL, " + std::to_string(locales.size()) + ")";
+
+    // entry_order: first appearance of the unique_id in the table (in any locale)
+    std::string fetch_sql =
+        "WITH locale_rank(locale, rank) AS (VALUES " + locale_values + "),"
+        " entries AS (SELECT *, rowid AS row_order,"
+        "   MIN(rowid) OVER (PARTITION BY unique_id) AS entry_order"
+        "   FROM " + globalvar::db_data_tablename + command_condition + "),"
+        " ranked AS (SELECT entries.*, locale_rank.rank AS rank,"
+        "   MIN(locale_rank.rank) OVER (PARTITION BY unique_id) AS best_rank"
+        "   FROM entries JOIN locale_rank ON entries.effective_locale IS locale_rank.locale)"
+        " SELECT " + columns + " FROM ranked WHERE rank = best_rank"
+        " ORDER BY entry_order, row_order;";
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(connection, fetch_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("SQL error: " + std::string(sqlite3_errmsg(connection)));
+    }
+    int idx = 1;
+    for (const auto& locale : locales) {
+        sqlite3_bind_text(stmt, idx++, locale.c_str(), -1, SQLITE_TRANSIENT);
+    }
+    for (const auto& basename : command_basenames) {
+        sqlite3_bind_text(stmt, idx++, basename.c_str(), -1, SQLITE_TRANSIENT);
+    }
 
-            if (!fetches.empty()) {
-                for (const auto& item : fetches) {
-                    // Filter by command
-                    if (command.has_value() && item.effective_command.has_value()) {
-                        if (!check_command(*item.effective_command, item.command_match_strictness,
-                                          *command, item.command_is_regex)) {
-                            continue;
-                        }
-                    }
-                    match_items.push_back(item);
-                }
-                fetched = true;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Item item = row_to_item(stmt);
+        // Filter by command
+        if (command.has_value() && item.effective_command.has_value()) {
+            if (!check_command(*item.effective_command, item.command_match_strictness,
+                              *command, item.command_is_regex)) {
+                continue;
             }
         }
+        match_items.push_back(std::move(item));
     }
+    sqlite3_finalize(stmt);
     return match_items;
 }
 
@@ -27,6 +27,11 @@ struct Item {
 
     std::string unique_id;
     std::string file_id;
+
+    // Literal that every match contains (none if it could not be determined)
+    std::optional<std::string> required_literal;
+    // Match the text without terminal escape sequences (see VisibleText)
+    bool ignore_escapes = false;
 };
 
 // Exceptions
@@ -64,12 +69,17 @@ void add_subst_entry(
     const std::string& unique_id,
     const std::string& file_id,
     const std::string& line_number_debug,
-    std::function<void(const std::string&)> warning_handler
+    std::function<void(const std::string&)> warning_handler,
+    bool ignore_escapes = false
 );
 
 // Fetch substitution rules for a command
 std::vector<Item> fetch_substrules(const std::optional<std::string>& command);
 
+// Normalized first phrase of a command: basename with common extensions removed
+// (stored as effective_command_basename for non-regex command filters)
+std::string command_basename(const std::string& first_phrase);
+
 // Check if a command matches a filter pattern
 bool check_command(const std::string& match_cmd, int strictness, const std::string& target_command, bool is_regex);
 
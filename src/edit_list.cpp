@@ -0,0 +1,26 @@
+#include "edit_list.hpp"
+#include <cassert>
+
+namespace clitheme {
+
+void EditList::add(size_t offset, size_t length, std::string replacement) {
+    assert((edits_.empty() || offset >= edits_.back().offset + edits_.back().length) &&
+           "Edits must be in order and must not overlap");
+    size_delta_ += static_cast<long long>(replacement.size()) - static_cast<long long>(length);
+    edits_.push_back(Edit{offset, length, std::move(replacement)});
+}
+
+std::string EditList::apply(const std::string& source) const {
+    std::string result;
+    result.reserve(result_size(source.size()));
+    size_t pos = 0;
+    for (const auto& edit : edits_) {
+        result.append(source, pos, edit.offset - pos);
+        result += edit.replacement;
+        pos = edit.offset + edit.length;
+    }
+    result.append(source, pos, std::string::npos);
+    return result;
+}
+
+} // namespace clitheme
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+
+// Substitutions recorded as (offset, length, replacement) edits against a source
+// buffer, applied in a single pass instead of splicing the buffer for every match.
+class EditList {
+public:
+    struct Edit {
+        size_t offset;
+        size_t length;
+        std::string replacement;
+    };
+
+    // Edits must be added in increasing, non-overlapping offset order
+    void add(size_t offset, size_t length, std::string replacement);
+    void clear() { edits_.clear(); size_delta_ = 0; }
+
+    bool empty() const { return edits_.empty(); }
+    const std::vector<Edit>& edits() const { return edits_; }
+
+    // Size of the result of applying the edits to a source of source_size bytes
+    size_t result_size(size_t source_size) const {
+        return static_cast<size_t>(static_cast<long long>(source_size) + size_delta_);
+    }
+
+    // Build the edited buffer
+    std::string apply(const std::string& source) const;
+
+private:
+    std::vector<Edit> edits_;
+    long long size_delta_ = 0;
+};
+
+} // namespace clitheme
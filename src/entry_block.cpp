@@ -242,7 +242,8 @@ void GeneratorObject::handle_entry(const std::string& start_phrase, const std::s
                         entry_name.id,
                         file_id,
                         line_number_debug,
-                        [this](const std::string& msg) { handle_warning(msg); }
+                        [this](const std::string& msg) { handle_warning(msg); },
+                        opt("ignoreescapes")
                     );
                 } catch (const db_interface::bad_pattern& e) {
                     if (checked_entries.find(entry.content_line_number) == checked_entries.end()) {
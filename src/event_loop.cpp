@@ -0,0 +1,70 @@
+#include "event_loop.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace clitheme {
+
+EventLoop::EventLoop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epoll_fd_ == -1) {
+        throw std::runtime_error("epoll_create1 failed: " + std::string(strerror(errno)));
+    }
+}
+
+EventLoop::~EventLoop() {
+    close(epoll_fd_);
+}
+
+void EventLoop::watch(int fd, uint32_t events) {
+    auto it = std::find_if(watches_.begin(), watches_.end(), [fd](const Watch& w) { return w.fd == fd; });
+    if (it != watches_.end() && it->events == events) return;
+
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (it == watches_.end()) {
+        if (events == 0) return;
+        bool always_ready = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1;
+        if (always_ready && errno != EPERM) {
+            throw std::runtime_error("epoll_ctl failed: " + std::string(strerror(errno)));
+        }
+        watches_.push_back({fd, events, always_ready});
+        return;
+    }
+    if (!it->always_ready) {
+        // Removed rather than left with no events: epoll would still report hangups
+        epoll_ctl(epoll_fd_, events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, fd, &event);
+    }
+    if (events == 0) {
+        watches_.erase(it);
+    } else {
+        it->events = events;
+    }
+}
+
+bool EventLoop::wait(int timeout_ms) {
+    bool any_ready = std::any_of(watches_.begin(), watches_.end(), [](const Watch& w) { return w.always_ready; });
+    ready_.resize(std::max<size_t>(watches_.size(), 1));
+    int n = epoll_wait(epoll_fd_, ready_.data(), static_cast<int>(ready_.size()), any_ready ? 0 : timeout_ms);
+    if (n == -1) {
+        ready_.clear();
+        if (errno == EINTR) return false;
+        throw std::runtime_error("epoll_wait failed: " + std::string(strerror(errno)));
+    }
+    ready_.resize(n);
+    return true;
+}
+
+uint32_t EventLoop::ready(int fd) const {
+    for (const auto& w : watches_) {
+        if (w.fd == fd && w.always_ready) return w.events;
+    }
+    for (const auto& event : ready_) {
+        if (event.data.fd == fd) return event.events;
+    }
+    return 0;
+}
+
+} // namespace clitheme
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <sys/epoll.h>
+
+namespace clitheme {
+
+// epoll set of the exec main loop (level-triggered).
+// The caller says each iteration which events it wants from each descriptor;
+// only changes reach the kernel. Descriptors epoll cannot watch (regular
+// files, /dev/null) count as always ready, as with poll().
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Watch fd for events (EPOLLIN, EPOLLOUT); 0 stops watching it
+    void watch(int fd, uint32_t events);
+    // Wait until a watched descriptor is ready or timeout_ms has passed (-1: no limit).
+    // Returns false if interrupted (EINTR); nothing is ready then.
+    bool wait(int timeout_ms);
+    // Events of fd reported by the last wait() (the same bits as poll()'s revents)
+    uint32_t ready(int fd) const;
+
+private:
+    struct Watch {
+        int fd;
+        uint32_t events;
+        bool always_ready;
+    };
+
+    int epoll_fd_;
+    std::vector<Watch> watches_;
+    std::vector<struct epoll_event> ready_;
+};
+
+} // namespace clitheme
@@ -1,114 +1,117 @@
 #include "exec_handler.hpp"
-#include "substrules_processor.hpp"
+#include "rule_set.hpp"
+#include "io_buffer.hpp"
+#include "output_channel.hpp"
+#include "output_pipeline.hpp"
+#include "event_loop.hpp"
+#include "globalvar.hpp"
 #include <unistd.h>
 #include <pty.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
-#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
-#include <chrono>
+#include <memory>
+#include <thread>
 
 namespace clitheme {
 
-// Static members
-int ExecHandler::s_pty_master = -1;
-pid_t ExecHandler::s_child_pid = -1;
-ExecHandler* ExecHandler::s_instance = nullptr;
-
-ExecHandler::ExecHandler(const std::vector<std::string>& argv)
-    : child_pid_(-1), pty_master_(-1), is_tty_(false), terminal_saved_(false) {
-    // Build command string for match_content
-    for (size_t i = 0; i < argv.size(); i++) {
-        if (i > 0) command_str_ += " ";
-        command_str_ += argv[i];
-    }
-
+ExecHandler::ExecHandler(const std::vector<std::string>& argv, const RuleSet& rules,
+                         const RuleSet* stderr_rules, const ExecOptions& options)
+    : child_pid_(-1), pty_master_(-1), stderr_master_(-1), is_tty_(false), terminal_saved_(false),
+      output_flags_{-1, -1}, rules_(rules), stderr_rules_(stderr_rules), options_(options),
+      signal_fd_(-1), timer_fd_(-1), timer_deadline_(std::chrono::steady_clock::time_point::max()),
+      child_fd_(-1), child_exited_(false), child_status_(0) {
     is_tty_ = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
 
     int master_fd, slave_fd;
     if (openpty(&master_fd, &slave_fd, nullptr, nullptr, nullptr) == -1) {
         throw std::runtime_error("openpty failed: " + std::string(strerror(errno)));
     }
+    // Second pty for stderr, so that programs still see a terminal there
+    int stderr_master_fd = -1, stderr_slave_fd = -1;
+    if (stderr_rules_ && openpty(&stderr_master_fd, &stderr_slave_fd, nullptr, nullptr, nullptr) == -1) {
+        close(master_fd);
+        close(slave_fd);
+        throw std::runtime_error("openpty failed: " + std::string(strerror(errno)));
+    }
 
     pid_t pid = fork();
     if (pid == -1) {
         close(master_fd);
         close(slave_fd);
+        if (stderr_master_fd >= 0) {
+            close(stderr_master_fd);
+            close(stderr_slave_fd);
+        }
         throw std::runtime_error("fork failed: " + std::string(strerror(errno)));
     }
 
     if (pid == 0) {
         // Child process
         close(master_fd);
+        if (stderr_master_fd >= 0) close(stderr_master_fd);
         setsid();
         ioctl(slave_fd, TIOCSCTTY, 0);
         dup2(slave_fd, STDIN_FILENO);
         dup2(slave_fd, STDOUT_FILENO);
-        dup2(slave_fd, STDERR_FILENO);
+        dup2(stderr_slave_fd >= 0 ? stderr_slave_fd : slave_fd, STDERR_FILENO);
         if (slave_fd > STDERR_FILENO) {
             close(slave_fd);
         }
-
-        // Build argv for execvp
-        std::vector<char*> c_argv;
-        for (const auto& arg : argv) {
-            c_argv.push_back(const_cast<char*>(arg.c_str()));
+        if (stderr_slave_fd > STDERR_FILENO) {
+            close(stderr_slave_fd);
         }
-        c_argv.push_back(nullptr);
 
-        execvp(c_argv[0], c_argv.data());
-        // If execvp returns, it failed
-        std::cerr << "exec failed: " << strerror(errno) << ": " << argv[0] << std::endl;
-        _exit(127);
+        _exit(exec_direct(argv));
     }
 
     // Parent process
     close(slave_fd);
+    if (stderr_slave_fd >= 0) close(stderr_slave_fd);
     pty_master_ = master_fd;
+    stderr_master_ = stderr_master_fd;
     child_pid_ = pid;
+    // The child is a session leader, so its process group id is its pid
+    terminal_ = std::make_unique<TerminalState>(pty_master_, pid);
 
-    s_pty_master = pty_master_;
-    s_child_pid = child_pid_;
-    s_instance = this;
+    // Signals from now on wait for the main loop (threads started later inherit the mask)
+    sigemptyset(&signals_);
+    for (int sig : {SIGWINCH, SIGINT, SIGTSTP, SIGCONT, SIGCHLD, SIGTERM, SIGHUP, SIGQUIT}) sigaddset(&signals_, sig);
+    pthread_sigmask(SIG_BLOCK, &signals_, &prev_sigmask_);
 
     if (is_tty_) {
         setup_raw_terminal();
         update_window_size();
     }
-
-    // Install signal handlers
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-
-    sa.sa_handler = handle_sigwinch;
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGWINCH, &sa, nullptr);
-
-    sa.sa_handler = handle_sigint;
-    sa.sa_flags = 0;
-    sigaction(SIGINT, &sa, nullptr);
-
-    sa.sa_handler = handle_sigtstp;
-    sa.sa_flags = 0;
-    sigaction(SIGTSTP, &sa, nullptr);
-
-    sa.sa_handler = handle_sigcont;
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGCONT, &sa, nullptr);
 }
 
 ExecHandler::~ExecHandler() {
+    restore_output_flags();
     if (is_tty_ && terminal_saved_) {
         restore_terminal();
     }
     if (pty_master_ >= 0) {
         close(pty_master_);
     }
-    s_instance = nullptr;
-    s_pty_master = -1;
-    s_child_pid = -1;
+    if (stderr_master_ >= 0) {
+        close(stderr_master_);
+    }
+    if (timer_fd_ >= 0) close(timer_fd_);
+    if (child_fd_ >= 0) close(child_fd_);
+    // Discard what is still queued (a late ^C must not end this process), then unblock
+    if (signal_fd_ >= 0) {
+        struct signalfd_siginfo info;
+        while (read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {}
+        close(signal_fd_);
+    }
+    pthread_sigmask(SIG_SETMASK, &prev_sigmask_, nullptr);
 }
 
 void ExecHandler::setup_raw_terminal() {
@@ -130,161 +133,251 @@ void ExecHandler::update_window_size() {
     struct winsize ws;
     if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0) {
         ioctl(pty_master_, TIOCSWINSZ, &ws);
+        if (stderr_master_ >= 0) ioctl(stderr_master_, TIOCSWINSZ, &ws);
     }
 }
 
-void ExecHandler::handle_sigwinch(int) {
-    if (s_instance && s_instance->is_tty_) {
-        s_instance->update_window_size();
-        if (s_child_pid > 0) {
-            kill(s_child_pid, SIGWINCH);
-        }
+void ExecHandler::set_output_nonblocking() {
+    const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    for (int i = 0; i < (stderr_master_ >= 0 ? 2 : 1); i++) {
+        // A terminal stays blocking: its flags are shared with the shell and whatever else
+        // writes to it (OutputChannel writes a bounded amount to it instead)
+        if (isatty(fds[i])) continue;
+        int flags = fcntl(fds[i], F_GETFL);
+        if (flags == -1) continue;
+        if (output_flags_[i] == -1) output_flags_[i] = flags;
+        fcntl(fds[i], F_SETFL, flags | O_NONBLOCK);
     }
 }
 
-void ExecHandler::handle_sigint(int) {
-    // Forward ^C through the PTY
-    if (s_pty_master >= 0) {
-        char c = '\x03';
-        write(s_pty_master, &c, 1);
+void ExecHandler::restore_output_flags() {
+    // The flags are shared with the shell's copy of the terminal
+    const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    for (int i = 1; i >= 0; i--) {
+        if (output_flags_[i] != -1) fcntl(fds[i], F_SETFL, output_flags_[i]);
     }
 }
 
-void ExecHandler::handle_sigtstp(int) {
-    if (s_instance && s_instance->is_tty_ && s_instance->terminal_saved_) {
-        s_instance->restore_terminal();
-    }
-    if (s_child_pid > 0) {
-        kill(s_child_pid, SIGSTOP);
+void ExecHandler::handle_signals(WriteQueue& pty_input) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+        case SIGWINCH:
+            if (is_tty_) {
+                update_window_size();
+                if (!child_exited_) kill(child_pid_, SIGWINCH);
+            }
+            break;
+        case SIGINT:
+            // Forward ^C through the PTY
+            pty_input.push("\x03");
+            break;
+        case SIGTSTP:
+            restore_output_flags();
+            if (is_tty_ && terminal_saved_) restore_terminal();
+            if (!child_exited_) kill(child_pid_, SIGSTOP);
+            // Stop ourselves; the SIGCONT that resumes us is read next and undoes the above
+            raise(SIGSTOP);
+            break;
+        case SIGCONT:
+            if (!child_exited_) kill(child_pid_, SIGCONT);
+            if (is_tty_) setup_raw_terminal();
+            set_output_nonblocking();
+            break;
+        case SIGTERM:
+        case SIGHUP:
+        case SIGQUIT: {
+            // Terminate as the signal would, but leave the terminal and output flags as they were
+            restore_output_flags();
+            if (is_tty_ && terminal_saved_) restore_terminal();
+            if (!child_exited_) kill(child_pid_, info.ssi_signo);
+            signal(info.ssi_signo, SIG_DFL);
+            pthread_sigmask(SIG_SETMASK, &prev_sigmask_, nullptr);
+            sigset_t sig;
+            sigemptyset(&sig);
+            sigaddset(&sig, info.ssi_signo);
+            pthread_sigmask(SIG_UNBLOCK, &sig, nullptr);
+            raise(info.ssi_signo);
+            break;
+        }
+        case SIGCHLD:
+            // The child stopped, continued or exited: its foreground state may have changed
+            terminal_->refresh();
+            if (child_fd_ < 0) reap_child();
+            break;
+        }
     }
-    // Stop ourselves: reset SIGTSTP to default, then re-raise
-    signal(SIGTSTP, SIG_DFL);
-    raise(SIGTSTP);
 }
 
-void ExecHandler::handle_sigcont(int) {
-    // Re-install our handler
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_sigtstp;
-    sa.sa_flags = 0;
-    sigaction(SIGTSTP, &sa, nullptr);
-
-    if (s_child_pid > 0) {
-        kill(s_child_pid, SIGCONT);
+void ExecHandler::reap_child() {
+    if (child_exited_) return;
+    int status = 0;
+    if (waitpid(child_pid_, &status, WNOHANG) == child_pid_) {
+        child_exited_ = true;
+        child_status_ = status;
     }
-    if (s_instance && s_instance->is_tty_) {
-        s_instance->setup_raw_terminal();
+}
+
+void ExecHandler::set_timer(std::chrono::steady_clock::time_point deadline) {
+    if (deadline == timer_deadline_) return;
+    timer_deadline_ = deadline;
+    // steady_clock is CLOCK_MONOTONIC; a zero it_value disarms the timer
+    struct itimerspec spec = {};
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+        auto since_epoch = std::max(deadline.time_since_epoch(), std::chrono::steady_clock::duration(1));
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+        spec.it_value.tv_sec = seconds.count();
+        spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count();
     }
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
 }
 
-int ExecHandler::run() {
-    std::string output_buffer;
-    auto last_data_time = std::chrono::steady_clock::now();
-    const auto flush_timeout = std::chrono::milliseconds(5);
-
-    while (true) {
-        struct pollfd fds[2];
-        int nfds = 0;
-
-        // Always poll pty_master
-        fds[nfds].fd = pty_master_;
-        fds[nfds].events = POLLIN;
-        nfds++;
-
-        // Poll stdin if tty
-        if (is_tty_) {
-            fds[nfds].fd = STDIN_FILENO;
-            fds[nfds].events = POLLIN;
-            nfds++;
-        }
+int ExecHandler::exec_direct(const std::vector<std::string>& argv) {
+    // Build argv for execvp
+    std::vector<char*> c_argv;
+    for (const auto& arg : argv) {
+        c_argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    c_argv.push_back(nullptr);
 
-        int poll_timeout = output_buffer.empty() ? -1 : 5;
-        int ret = poll(fds, nfds, poll_timeout);
+    execvp(c_argv[0], c_argv.data());
+    // If execvp returns, it failed
+    std::cerr << "exec failed: " << strerror(errno) << ": " << argv[0] << std::endl;
+    return 127;
+}
 
-        if (ret == -1) {
-            if (errno == EINTR) continue;
-            break;
+int ExecHandler::run() {
+    signal_fd_ = signalfd(-1, &signals_, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd_ == -1) {
+        throw std::runtime_error("signalfd failed: " + std::string(strerror(errno)));
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ == -1) {
+        throw std::runtime_error("timerfd_create failed: " + std::string(strerror(errno)));
+    }
+#ifdef SYS_pidfd_open
+    child_fd_ = static_cast<int>(syscall(SYS_pidfd_open, child_pid_, 0));
+#endif
+    // The child may have exited before SIGCHLD was blocked
+    if (child_fd_ < 0) reap_child();
+
+    EventLoop loop;
+    loop.watch(signal_fd_, EPOLLIN);
+    loop.watch(timer_fd_, EPOLLIN);
+
+    set_output_nonblocking();
+    fcntl(pty_master_, F_SETFL, fcntl(pty_master_, F_GETFL) | O_NONBLOCK);
+
+    // Child stdout (and stderr, unless it has its own pty): handled on this thread,
+    // or by a reader/substituter/writer pipeline in threaded mode
+    std::unique_ptr<OutputChannel> output;
+    std::unique_ptr<OutputPipeline> pipeline;
+    if (options_.threaded) {
+        pipeline = std::make_unique<OutputPipeline>(pty_master_, STDOUT_FILENO, rules_, options_.flush, terminal_.get());
+    } else {
+        output = std::make_unique<OutputChannel>(pty_master_, STDOUT_FILENO, rules_, options_.flush, terminal_.get());
+    }
+    // User input for the child
+    WriteQueue pty_queue;
+
+    // Separate stderr: processed on its own thread(s), so that it cannot hold up stdout
+    std::unique_ptr<OutputChannel> error_output;
+    std::unique_ptr<OutputPipeline> error_pipeline;
+    std::thread error_thread;
+    if (stderr_master_ >= 0) {
+        fcntl(stderr_master_, F_SETFL, fcntl(stderr_master_, F_GETFL) | O_NONBLOCK);
+        // The child's input mode is on the stdin pty
+        if (options_.threaded) {
+            error_pipeline = std::make_unique<OutputPipeline>(stderr_master_, STDERR_FILENO, *stderr_rules_,
+                                                              options_.flush, terminal_.get());
+        } else {
+            error_output = std::make_unique<OutputChannel>(stderr_master_, STDERR_FILENO, *stderr_rules_,
+                                                           options_.flush, terminal_.get());
+            error_thread = std::thread([&error_output]() {
+                // Leave the signals to the main thread
+                sigset_t signals;
+                sigfillset(&signals);
+                sigdelset(&signals, SIGPIPE);
+                pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+                error_output->run();
+            });
         }
+    }
 
-        if (ret == 0 && !output_buffer.empty()) {
-            // Timeout: flush incomplete buffer
-            auto now = std::chrono::steady_clock::now();
-            if (now - last_data_time >= flush_timeout) {
-                auto [processed, _] = substrules_processor::match_content(
-                    output_buffer, command_str_, false);
-                write(STDOUT_FILENO, processed.data(), processed.size());
-                output_buffer.clear();
-            }
-            continue;
+    bool output_open = true;
+    bool stdin_open = is_tty_;
+    while (output_open) {
+        // pty_master: output unless stdout is too far behind, and pending input.
+        // The pipeline reads the pty itself, so then it is only watched for input.
+        uint32_t pty_events = output ? output->input_events() : 0;
+        if (!pty_queue.empty()) pty_events |= EPOLLOUT;
+        loop.watch(pty_master_, pty_events);
+
+        // stdin if tty, unless input for the child is piling up
+        bool read_stdin = stdin_open && pty_queue.pending() < globalvar::exec_write_queue_limit;
+        loop.watch(STDIN_FILENO, read_stdin ? uint32_t(EPOLLIN) : 0u);
+
+        // stdout while output is queued, or the end of the pipeline's input
+        loop.watch(STDOUT_FILENO, output && output->has_pending_output() ? uint32_t(EPOLLOUT) : 0u);
+        if (pipeline) loop.watch(pipeline->done_fd(), EPOLLIN);
+
+        // Until it has exited (and been collected)
+        if (child_fd_ >= 0) loop.watch(child_fd_, child_exited_ ? 0u : uint32_t(EPOLLIN));
+
+        if (output) set_timer(output->flush_deadline());
+
+        if (!loop.wait(-1)) continue;
+
+        if (loop.ready(signal_fd_)) handle_signals(pty_queue);
+        if (child_fd_ >= 0 && loop.ready(child_fd_)) reap_child();
+        if (loop.ready(timer_fd_)) {
+            uint64_t expirations;
+            ssize_t n = read(timer_fd_, &expirations, sizeof(expirations));
+            (void)n;
+            timer_deadline_ = std::chrono::steady_clock::time_point::max();
         }
 
         // Check stdin (user input -> pty)
-        if (is_tty_) {
-            int stdin_idx = nfds - 1; // stdin is the last fd
-            if (fds[stdin_idx].revents & POLLIN) {
-                char buf[4096];
-                ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
-                if (n > 0) {
-                    write(pty_master_, buf, n);
-                }
-            }
-        }
-
-        // Check pty_master (child output -> process + stdout)
-        if (fds[0].revents & (POLLIN | POLLHUP)) {
+        if (read_stdin && loop.ready(STDIN_FILENO)) {
             char buf[4096];
-            ssize_t n = read(pty_master_, buf, sizeof(buf));
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            // A hung-up terminal stays ready: stop watching it
+            if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) stdin_open = false;
             if (n > 0) {
-                output_buffer.append(buf, n);
-                last_data_time = std::chrono::steady_clock::now();
-
-                // Find the last newline in the buffer
-                size_t last_nl = std::string::npos;
-                for (size_t i = output_buffer.size(); i > 0; i--) {
-                    char c = output_buffer[i - 1];
-                    if (c == '\n' || c == '\r') {
-                        last_nl = i;
-                        break;
-                    }
-                }
-
-                if (last_nl != std::string::npos) {
-                    std::string complete = output_buffer.substr(0, last_nl);
-                    output_buffer = output_buffer.substr(last_nl);
-
-                    auto [processed, _] = substrules_processor::match_content(
-                        complete, command_str_, false);
-                    write(STDOUT_FILENO, processed.data(), processed.size());
-                }
-            } else {
-                // EOF or error from PTY — child likely exited
-                break;
+                pty_queue.push(std::string(buf, n));
+                // Show the echo and the reply without batching delay (prompts may be on stderr)
+                if (output) output->note_input();
+                if (pipeline) pipeline->note_input();
+                if (error_output) error_output->note_input();
+                if (error_pipeline) error_pipeline->note_input();
             }
         }
-
-        if (fds[0].revents & POLLHUP) {
-            // Read any remaining data
-            char buf[4096];
-            while (true) {
-                ssize_t n = read(pty_master_, buf, sizeof(buf));
-                if (n <= 0) break;
-                output_buffer.append(buf, n);
-            }
-            break;
+        if (!pty_queue.empty()) pty_queue.flush(pty_master_);
+
+        if (output) {
+            // Check pty_master (child output -> process + stdout); epoll and poll use the same event bits
+            output->handle_input(static_cast<short>(loop.ready(pty_master_)));
+            if (loop.ready(STDOUT_FILENO)) output->handle_output();
+            output->handle_timeout();
+            output_open = output->is_open();
+        } else {
+            output_open = !(loop.ready(pipeline->done_fd()) & EPOLLIN);
         }
     }
 
-    // Flush remaining buffer
-    if (!output_buffer.empty()) {
-        auto [processed, _] = substrules_processor::match_content(
-            output_buffer, command_str_, false);
-        write(STDOUT_FILENO, processed.data(), processed.size());
-    }
+    // Flush remaining output
+    if (output) output->finish();
+    if (pipeline) pipeline->finish();
+    if (error_thread.joinable()) error_thread.join();
+    if (error_pipeline) error_pipeline->finish();
+    restore_output_flags();
+    stats_[0] = output ? output->stats() : pipeline->stats();
+    if (error_output) stats_[1] = error_output->stats();
+    if (error_pipeline) stats_[1] = error_pipeline->stats();
 
     // Wait for child and get exit status
-    int status = 0;
-    waitpid(child_pid_, &status, 0);
+    if (!child_exited_ && waitpid(child_pid_, &child_status_, 0) == child_pid_) child_exited_ = true;
+    int status = child_status_;
 
     if (is_tty_ && terminal_saved_) {
         restore_terminal();
@@ -1,40 +1,84 @@
 #pragma once
+#include "output_channel.hpp"
+#include "terminal_state.hpp"
 #include <string>
 #include <vector>
+#include <memory>
+#include <chrono>
 #include <termios.h>
+#include <signal.h>
 #include <sys/types.h>
 
 namespace clitheme {
 
+class RuleSet;
+class WriteQueue;
+
+struct ExecOptions {
+    // Read, substitute and write each output stream on separate threads
+    bool threaded = false;
+    FlushOptions flush;
+};
+
 class ExecHandler {
 public:
-    ExecHandler(const std::vector<std::string>& argv);
+    // rules must outlive the handler. With stderr_rules, the child's stderr gets a
+    // pty of its own and is processed with those rules on a separate thread;
+    // otherwise stdout and stderr share one pty and use rules.
+    ExecHandler(const std::vector<std::string>& argv, const RuleSet& rules,
+                const RuleSet* stderr_rules = nullptr, const ExecOptions& options = ExecOptions());
     ~ExecHandler();
 
     // Main loop: forward I/O and process output. Returns child exit code.
     int run();
+    // Counters of the child's stdout (or stderr) after run()
+    const OutputStats& stats(bool is_stderr = false) const { return stats_[is_stderr]; }
+
+    // Replace this process with the command, without a pty or any processing
+    // (for when no rules apply). Returns only if execvp fails, with exit code 127.
+    static int exec_direct(const std::vector<std::string>& argv);
 
 private:
     void setup_raw_terminal();
     void restore_terminal();
     void update_window_size();
+    // Switch stdout (and stderr) to non-blocking mode for the write queues, unless a terminal, and back
+    void set_output_nonblocking();
+    void restore_output_flags();
 
-    static void handle_sigwinch(int sig);
-    static void handle_sigint(int sig);
-    static void handle_sigtstp(int sig);
-    static void handle_sigcont(int sig);
+    // Act on the signals queued on signal_fd_ (^C goes to pty_input)
+    void handle_signals(WriteQueue& pty_input);
+    // Collect the child's exit status once it has exited
+    void reap_child();
+    // Arm timer_fd_ for deadline (time_point::max(): disarm)
+    void set_timer(std::chrono::steady_clock::time_point deadline);
 
     pid_t child_pid_;
     int pty_master_;
+    int stderr_master_; // -1 unless stderr has its own pty
+    std::unique_ptr<TerminalState> terminal_;
     struct termios prev_termios_;
     bool is_tty_;
     bool terminal_saved_;
-    std::string command_str_;
+    // Original file status flags of stdout and stderr; -1 if not changed
+    int output_flags_[2];
+    const RuleSet& rules_;
+    const RuleSet* stderr_rules_;
+    ExecOptions options_;
+    OutputStats stats_[2];
 
-    // Static state for signal handlers
-    static int s_pty_master;
-    static pid_t s_child_pid;
-    static ExecHandler* s_instance;
+    // SIGWINCH, SIGINT, SIGTSTP, SIGCONT, SIGCHLD, SIGTERM, SIGHUP and SIGQUIT are blocked
+    // and read from signal_fd_ by the main loop instead of interrupting it
+    sigset_t signals_;
+    sigset_t prev_sigmask_;
+    int signal_fd_;
+    // Flush deadline of the output
+    int timer_fd_;
+    std::chrono::steady_clock::time_point timer_deadline_;
+    // pidfd of the child; -1 without kernel support (SIGCHLD tells then)
+    int child_fd_;
+    bool child_exited_;
+    int child_status_;
 };
 
 } // namespace clitheme
@@ -0,0 +1,72 @@
+#include "flush_policy.hpp"
+#include <algorithm>
+
+namespace clitheme {
+
+// Output that arrives this soon after user input is treated as its echo/reply
+static const auto input_echo_window = std::chrono::milliseconds(100);
+
+FlushPolicy::FlushPolicy(const FlushOptions& options) : options_(options) {
+    options_.max_latency = std::max(options_.max_latency, options_.min_latency);
+}
+
+void FlushPolicy::on_data(clock::time_point now) {
+    streaming_ = has_data_ && now - last_data_ < options_.min_latency;
+    if (!has_data_) pending_since_ = now;
+    last_data_ = now;
+    has_data_ = true;
+}
+
+void FlushPolicy::on_processed(clock::time_point now, size_t pending) {
+    has_data_ = pending > 0;
+    last_data_ = now;
+    pending_since_ = now;
+}
+
+FlushPolicy::Action FlushPolicy::decide(clock::time_point now, size_t pending, bool has_complete_line,
+                                        bool interactive) {
+    if (pending == 0) return Action::wait;
+    if (interactive || now - last_input_ < input_echo_window) {
+        stats_.interactive++;
+        return Action::all;
+    }
+    if (now - last_data_ >= options_.min_latency) {
+        stats_.idle++;
+        return Action::all;
+    }
+    if (!has_complete_line) return Action::wait;
+    if (!streaming_) {
+        stats_.immediate++;
+        return Action::lines;
+    }
+    if (pending >= options_.batch_size) {
+        stats_.batch_full++;
+        return Action::lines;
+    }
+    if (now - pending_since_ >= options_.max_latency) {
+        stats_.max_latency++;
+        return Action::lines;
+    }
+    return Action::wait;
+}
+
+FlushPolicy::clock::time_point FlushPolicy::deadline(size_t pending, bool has_complete_line) const {
+    if (pending == 0) return clock::time_point::max();
+    auto deadline = last_data_ + options_.min_latency;
+    if (has_complete_line) deadline = std::min(deadline, pending_since_ + options_.max_latency);
+    return deadline;
+}
+
+int FlushPolicy::poll_timeout(clock::time_point now, size_t pending, bool has_complete_line) const {
+    return timeout_until(now, deadline(pending, has_complete_line));
+}
+
+int FlushPolicy::timeout_until(clock::time_point now, clock::time_point deadline) {
+    if (deadline == clock::time_point::max()) return -1;
+    if (deadline <= now) return 0;
+    // Round up, so that the deadline has passed when poll() returns
+    auto wait = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+    return static_cast<int>(wait.count());
+}
+
+} // namespace clitheme
@@ -0,0 +1,75 @@
+#pragma once
+#include "globalvar.hpp"
+#include <chrono>
+#include <cstddef>
+
+namespace clitheme {
+
+// Counters of the flush decisions of one stream (exec --stats)
+struct FlushStats {
+    size_t immediate = 0;   // Lines processed as they arrived (output was not streaming)
+    size_t batch_full = 0;  // Streaming lines processed at batch_size
+    size_t max_latency = 0; // Streaming lines processed after max_latency
+    size_t idle = 0;        // Everything processed after min_latency without data
+    size_t interactive = 0; // Everything processed at once (raw mode or recent user input)
+    size_t held = 0;        // Output held back for a multiline rule (see MultilineHold)
+};
+
+// Tunables of FlushPolicy
+struct FlushOptions {
+    std::chrono::milliseconds min_latency{globalvar::exec_flush_min_latency_ms};
+    std::chrono::milliseconds max_latency{globalvar::exec_flush_max_latency_ms};
+    size_t batch_size = globalvar::exec_flush_batch_size;
+};
+
+// Decides when buffered output is passed to match_content.
+// Output that arrives after a pause is processed right away. While output is
+// streaming (reads less than min_latency apart), complete lines are batched up
+// to batch_size or max_latency, which saves many calls on small chunks. An
+// incomplete line waits until no data came for min_latency, unless the child is
+// interactive (terminal in raw mode, or user input was just forwarded); then
+// everything is processed at once.
+class FlushPolicy {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class Action {
+        wait,  // Keep buffering
+        lines, // Process the complete lines
+        all,   // Process everything, incomplete line included
+    };
+
+    explicit FlushPolicy(const FlushOptions& options = FlushOptions());
+
+    const FlushOptions& options() const { return options_; }
+
+    // Data was read
+    void on_data(clock::time_point now);
+    // User input was forwarded to the child: its echo and reply should show at once
+    void on_input(clock::time_point now) { last_input_ = now; }
+    // Buffered output was processed; pending is what is left. The idle time of
+    // what is left counts from now, so processing time is not mistaken for a pause.
+    void on_processed(clock::time_point now, size_t pending);
+
+    // What to do with pending buffered bytes; interactive: the child reads raw input
+    Action decide(clock::time_point now, size_t pending, bool has_complete_line, bool interactive);
+    // When decide() may change its answer (time_point::max(): not before more data)
+    clock::time_point deadline(size_t pending, bool has_complete_line) const;
+    // poll() timeout in milliseconds until deadline() (-1: none)
+    int poll_timeout(clock::time_point now, size_t pending, bool has_complete_line) const;
+    // poll() timeout in milliseconds until deadline (time_point::max(): -1)
+    static int timeout_until(clock::time_point now, clock::time_point deadline);
+
+    const FlushStats& stats() const { return stats_; }
+
+private:
+    FlushOptions options_;
+    clock::time_point last_data_;
+    clock::time_point last_input_;
+    clock::time_point pending_since_;
+    bool streaming_ = false;
+    bool has_data_ = false;
+    FlushStats stats_;
+};
+
+} // namespace clitheme
@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
 namespace clitheme {
 namespace globalvar {
@@ -33,10 +34,45 @@ inline std::string format_info_v2filename(const std::string& info) {
 // Database file and table names
 inline const std::string db_data_tablename = "clitheme_subst_data";
 inline const std::string db_filename = "subst-data.db";
-constexpr int db_version = 8;
+constexpr int db_version = 12;
 
-// Timeout for output substitution
+// Directory (under the root data path) holding serialized compiled patterns
+inline const std::string pattern_cache_pathname = "pattern-cache";
+
+// Timeout for output substitution (seconds per chunk); a chunk that runs out of it
+// is passed through unprocessed
 constexpr double output_subst_timeout = 1.0;
+// A rule is skipped from then on only if it used this much thread CPU time itself in a chunk
+// that ran out of the budget, or ran out of a match limit granted for this much time (time
+// the process was stopped or waited for a CPU does not count)
+constexpr double output_subst_slow_rule_cpu_time = output_subst_timeout / 2;
+// PCRE2 match limit granted per second of the remaining budget (about what JIT-compiled
+// matching gets through), and heap limit (KiB) for a single match during output substitution
+constexpr double output_subst_match_limit_per_second = 100000000;
+constexpr uint32_t output_subst_heap_limit_kib = 64 * 1024;
+
+// exec I/O: largest single read from the pty, cap of the unprocessed output buffer,
+// and queued output above which the pty is no longer read (backpressure)
+constexpr size_t exec_read_size = 64 * 1024;
+constexpr size_t exec_output_buffer_cap = 1024 * 1024;
+constexpr size_t exec_write_queue_limit = 4 * 1024 * 1024;
+// Most written to a blocking output (a terminal, which stays blocking) per poll wakeup,
+// so that a slow terminal holds up the event loop only briefly
+constexpr size_t exec_blocking_write_size = 16 * 1024;
+// Chunks each queue of the threaded exec pipeline holds before its producer waits
+constexpr size_t exec_pipeline_queue_length = 16;
+// Default flush policy (see FlushPolicy): idle time before buffered output is processed,
+// longest a batch of streaming lines is held, and batch size that is processed at once
+constexpr int exec_flush_min_latency_ms = 5;
+constexpr int exec_flush_max_latency_ms = 50;
+constexpr size_t exec_flush_batch_size = 64 * 1024;
+// Multiline rules (see MultilineHold): trailing output searched for the start of a match
+// that more output could complete, and how long such output is held back at most
+constexpr size_t exec_multiline_window = 16 * 1024;
+constexpr int exec_multiline_hold_ms = 100;
+// When the output buffer fills up without a newline, at most this much of its end is kept
+// back because a rule could still match there (see substrules_processor::decided_length)
+constexpr size_t exec_undecided_tail_cap = 64 * 1024;
 
 // Newline byte sequences (order matters: \r\n must come before \r and \n)
 inline const std::vector<std::string> newlines = {
@@ -0,0 +1,157 @@
+#include "io_buffer.hpp"
+#include "newline_scan.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/uio.h>
+
+namespace clitheme {
+
+RingBuffer::RingBuffer(size_t initial_capacity, size_t max_capacity)
+    : data_(std::min(std::max<size_t>(initial_capacity, 1), max_capacity)), head_(0), size_(0),
+      max_capacity_(max_capacity) {}
+
+void RingBuffer::reserve(size_t needed) {
+    assert(size_ + needed <= max_capacity_ && "RingBuffer over capacity");
+    if (size_ + needed <= data_.size()) return;
+    size_t new_capacity = data_.size();
+    while (new_capacity < size_ + needed) new_capacity *= 2;
+    new_capacity = std::min(new_capacity, max_capacity_);
+
+    // Move the contents to the front of the new storage
+    std::vector<char> grown(new_capacity);
+    size_t first = std::min(size_, data_.size() - head_);
+    std::memcpy(grown.data(), data_.data() + head_, first);
+    std::memcpy(grown.data() + first, data_.data(), size_ - first);
+    data_.swap(grown);
+    head_ = 0;
+}
+
+ssize_t RingBuffer::read_from(int fd, size_t max_bytes) {
+    max_bytes = std::min(max_bytes, space());
+    if (max_bytes == 0) return 0;
+    reserve(max_bytes);
+
+    // The free space is at most two pieces: after the data, then wrapped to the front
+    size_t tail = (head_ + size_) % data_.size();
+    struct iovec iov[2];
+    int iovcnt = 1;
+    iov[0].iov_base = data_.data() + tail;
+    iov[0].iov_len = std::min(max_bytes, data_.size() - tail);
+    if (iov[0].iov_len < max_bytes) {
+        iov[1].iov_base = data_.data();
+        iov[1].iov_len = max_bytes - iov[0].iov_len;
+        iovcnt = 2;
+    }
+    ssize_t n = readv(fd, iov, iovcnt);
+    if (n > 0) size_ += static_cast<size_t>(n);
+    return n;
+}
+
+void RingBuffer::append(const char* data, size_t length) {
+    reserve(length);
+    size_t tail = (head_ + size_) % data_.size();
+    size_t first = std::min(length, data_.size() - tail);
+    std::memcpy(data_.data() + tail, data, first);
+    std::memcpy(data_.data(), data + first, length - first);
+    size_ += length;
+}
+
+size_t RingBuffer::find_last_newline() const {
+    size_t first = std::min(size_, data_.size() - head_);
+    // Wrapped part first: it holds the end of the data
+    size_t wrapped = newline_scan::find_last(data_.data(), size_ - first);
+    if (wrapped != std::string::npos) return first + wrapped;
+    return newline_scan::find_last(data_.data() + head_, first);
+}
+
+std::string RingBuffer::copy(size_t offset, size_t length) const {
+    assert(offset + length <= size_ && "copy() past the end of the buffer");
+    std::string result;
+    result.reserve(length);
+    size_t start = (head_ + offset) % std::max<size_t>(data_.size(), 1);
+    size_t first = std::min(length, data_.size() - start);
+    result.append(data_.data() + start, first);
+    result.append(data_.data(), length - first);
+    return result;
+}
+
+std::string RingBuffer::take(size_t length) {
+    assert(length <= size_ && "take() past the end of the buffer");
+    std::string result;
+    result.reserve(length);
+    size_t first = std::min(length, data_.size() - head_);
+    result.append(data_.data() + head_, first);
+    result.append(data_.data(), length - first);
+    head_ = (head_ + length) % data_.size();
+    size_ -= length;
+    if (size_ == 0) head_ = 0;
+    return result;
+}
+
+void WriteQueue::push(std::string data) {
+    if (data.empty()) return;
+    pending_ += data.size();
+    chunks_.push_back(std::move(data));
+}
+
+bool WriteQueue::flush(int fd, size_t limit) {
+    // Chunks per writev call
+    constexpr size_t max_iov = 64;
+    while (!chunks_.empty() && limit > 0) {
+        struct iovec iov[max_iov];
+        size_t iovcnt = 0;
+        size_t total = 0;
+        for (auto it = chunks_.begin(); it != chunks_.end() && iovcnt < max_iov && total < limit; ++it, ++iovcnt) {
+            size_t skip = iovcnt == 0 ? offset_ : 0;
+            iov[iovcnt].iov_base = const_cast<char*>(it->data() + skip);
+            iov[iovcnt].iov_len = std::min(it->size() - skip, limit - total);
+            total += iov[iovcnt].iov_len;
+        }
+        ssize_t n = writev(fd, iov, static_cast<int>(iovcnt));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            clear();
+            return false;
+        }
+        // Drop what was written, keeping the unwritten part of a partially written chunk
+        size_t written = static_cast<size_t>(n);
+        pending_ -= written;
+        limit -= written;
+        while (written > 0) {
+            size_t left = chunks_.front().size() - offset_;
+            if (written < left) {
+                offset_ += written;
+                break;
+            }
+            written -= left;
+            chunks_.pop_front();
+            offset_ = 0;
+        }
+    }
+    return true;
+}
+
+bool WriteQueue::drain(int fd) {
+    while (!chunks_.empty()) {
+        if (!flush(fd)) return false;
+        if (chunks_.empty()) break;
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void WriteQueue::clear() {
+    chunks_.clear();
+    offset_ = 0;
+    pending_ = 0;
+}
+
+} // namespace clitheme
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace clitheme {
+
+// Byte ring buffer for data read from a file descriptor.
+// Starts small and doubles (up to max_capacity) as data arrives; reads go straight
+// into the free space with readv, so nothing is copied until a chunk is taken out.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t initial_capacity = 4096, size_t max_capacity = 1024 * 1024);
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return data_.size(); }
+    size_t max_capacity() const { return max_capacity_; }
+    // Bytes that can still be added before reaching max_capacity
+    size_t space() const { return max_capacity_ - size_; }
+
+    // read() up to max_bytes (limited to space()) from fd into the buffer; returns read()'s result
+    ssize_t read_from(int fd, size_t max_bytes);
+    void append(const char* data, size_t length);
+
+    // Offset of the last newline byte (see newline_scan); npos if none
+    size_t find_last_newline() const;
+
+    // Copy of length bytes starting at offset, leaving the buffer as it is
+    std::string copy(size_t offset, size_t length) const;
+    // Remove and return the first length bytes
+    std::string take(size_t length);
+    std::string take_all() { return take(size_); }
+
+private:
+    // Make room for needed more bytes, growing by doubling (never past max_capacity)
+    void reserve(size_t needed);
+
+    std::vector<char> data_;
+    size_t head_;
+    size_t size_;
+    size_t max_capacity_;
+};
+
+// Queue of output chunks for a non-blocking file descriptor.
+// flush() writes as much as the descriptor accepts with writev and keeps the rest,
+// including the unwritten part of a chunk after a short write.
+class WriteQueue {
+public:
+    void push(std::string data);
+
+    bool empty() const { return chunks_.empty(); }
+    // Bytes waiting to be written
+    size_t pending() const { return pending_; }
+
+    // Write until the queue is empty or fd would block, at most limit bytes. Returns false
+    // on a write error (other than EAGAIN/EINTR); the queued data is dropped then.
+    bool flush(int fd, size_t limit = SIZE_MAX);
+    // Like flush, but waits (poll) until everything is written
+    bool drain(int fd);
+    // Drop everything queued
+    void clear();
+
+private:
+    std::deque<std::string> chunks_;
+    size_t offset_ = 0; // Bytes of chunks_.front() already written
+    size_t pending_ = 0;
+};
+
+} // namespace clitheme
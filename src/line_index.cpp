@@ -0,0 +1,19 @@
+#include "line_index.hpp"
+#include "newline_scan.hpp"
+#include <algorithm>
+
+namespace clitheme {
+
+LineIndex::LineIndex(const std::string& content) : content_size_(content.size()) {
+    starts_.push_back(0);
+    newline_scan::find_line_ends(content.data(), content.size(), starts_);
+    // A newline at the very end does not start another line
+    if (starts_.size() > 1 && starts_.back() == content.size()) starts_.pop_back();
+}
+
+size_t LineIndex::line_of(size_t offset) const {
+    auto it = std::upper_bound(starts_.begin(), starts_.end(), offset);
+    return static_cast<size_t>(it - starts_.begin()) - 1;
+}
+
+} // namespace clitheme
@@ -0,0 +1,35 @@
+#pragma once
+#include "newline_scan.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+
+// Line boundary table for a chunk of output.
+// Lines are split after every newline sequence in globalvar::newlines ("\r\n" counts
+// as one, see newline_scan), the same way as globalvar::build_line_match_pattern(); each line includes
+// its trailing newline sequence, and the last line may have none.
+// Empty content has a single empty line.
+class LineIndex {
+public:
+    explicit LineIndex(const std::string& content);
+
+    // Number of lines (at least 1)
+    size_t size() const { return starts_.size(); }
+    size_t line_start(size_t line) const { return starts_[line]; }
+    size_t line_end(size_t line) const { return line + 1 < starts_.size() ? starts_[line + 1] : content_size_; }
+    size_t line_length(size_t line) const { return line_end(line) - line_start(line); }
+
+    // Index of the line containing offset (offset < content size)
+    size_t line_of(size_t offset) const;
+
+    // Whether c ends a newline sequence in globalvar::newlines
+    static bool is_newline_byte(char c) { return newline_scan::is_newline_byte(c); }
+
+private:
+    std::vector<size_t> starts_;
+    size_t content_size_ = 0;
+};
+
+} // namespace clitheme
@@ -7,15 +7,22 @@
 #include "db_interface.hpp"
 #include "substrules_processor.hpp"
 #include "exec_handler.hpp"
+#include "output_channel.hpp"
+#include "rule_set.hpp"
 #include "string_utils.hpp"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
+#include <optional>
 #include <filesystem>
 #include <random>
 #include <regex>
 #include <sstream>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
 
 namespace fs = std::filesystem;
 
@@ -23,12 +30,27 @@ static void print_usage() {
     std::cerr << "Usage:\n"
               << "  clitheme-cpp generate <file> [options]\n"
               << "  clitheme-cpp exec [options] <command> [args...]\n"
+              << "  clitheme-cpp filter [options]\n"
               << "\nGenerate options:\n"
               << "  --output-path <path>    Output directory (default: auto-generated temp dir)\n"
               << "  --overlay               Overlay mode\n"
               << "  --infofile-name <name>  Theme info subdirectory name (default: \"1\")\n"
               << "\nExec options:\n"
-              << "  --db-path <path>        Database path (default: ~/.local/share/clitheme/subst-data.db)\n";
+              << "  --db-path <path>        Database path (default: ~/.local/share/clitheme/subst-data.db)\n"
+              << "  --combine-regex         Scan the regex rules of each file together in one pass\n"
+              << "  --separate-stderr       Give the command's stderr its own terminal and apply\n"
+              << "                          stdout-only/stderr-only rules to each stream\n"
+              << "  --threaded              Read, substitute and write output on separate threads\n"
+              << "  --stats                 Print how the command was run and output counters to stderr\n"
+              << "  --min-latency <ms>      Idle time before buffered output is processed (default: 5)\n"
+              << "  --max-latency <ms>      Longest streaming output is held for batching (default: 50)\n"
+              << "  --batch-size <bytes>    Batch size of streaming output (default: 65536)\n"
+              << "\nFilter options (read stdin, write stdout):\n"
+              << "  --db-path <path>        Database path (default: ~/.local/share/clitheme/subst-data.db)\n"
+              << "  --command <cmdline>     Apply the rules for this command line\n"
+              << "  --stderr                Treat the input as stderr output (stderr-only rules)\n"
+              << "  --combine-regex         Scan the regex rules of each file together in one pass\n"
+              << "  --min-latency, --max-latency, --batch-size, --stats: as for exec\n";
 }
 
 static std::string generate_temp_path() {
@@ -211,14 +233,78 @@ static int cmd_generate(int argc, char* argv[]) {
     return 1;
 }
 
+static void print_output_stats(const std::string& stream, const clitheme::OutputStats& s) {
+    double ms = std::chrono::duration<double, std::milli>(s.substitution_time).count();
+    std::cerr << "clitheme-cpp: stats: " << stream << ": "
+              << s.bytes_read << " bytes in, " << s.bytes_written << " bytes out, "
+              << s.chunks << " chunks, " << ms << " ms substituting\n";
+    const auto& f = s.flushes;
+    std::cerr << "clitheme-cpp: stats: " << stream << " flushes: "
+              << f.immediate << " immediate, " << f.batch_full << " batch full, "
+              << f.max_latency << " max latency, " << f.idle << " idle, "
+              << f.interactive << " interactive, " << f.held << " held for multiline rules\n";
+}
+
+static void print_slow_rules(const clitheme::RuleSet& rules) {
+    for (size_t index : rules.slow_rules()) {
+        const auto& rule = rules.rules()[index];
+        std::cerr << "clitheme-cpp: stats: rule too slow, skipped after timeout: "
+                  << clitheme::string_utils::make_printable(rule.match_pattern) << "\n";
+    }
+}
+
+static void print_exec_stats(const clitheme::ExecHandler& handler, bool threaded, bool separate_stderr) {
+    std::cerr << "clitheme-cpp: stats: path: pty proxy" << (threaded ? " (threaded)" : "") << "\n";
+    print_output_stats("stdout", handler.stats());
+    if (separate_stderr) print_output_stats("stderr", handler.stats(true));
+}
+
+// Handle --min-latency/--max-latency <ms> and --batch-size <bytes>; false on an invalid value
+static bool parse_flush_option(const std::string& arg, const std::string& value,
+                               clitheme::FlushOptions& flush) {
+    long long number = -1;
+    try {
+        size_t end = 0;
+        number = std::stoll(value, &end);
+        if (end != value.size()) number = -1;
+    } catch (...) {
+    }
+    if (number < 0) {
+        std::cerr << "Error: invalid value for " << arg << ": " << value << "\n";
+        return false;
+    }
+    if (arg == "--min-latency") flush.min_latency = std::chrono::milliseconds(number);
+    else if (arg == "--max-latency") flush.max_latency = std::chrono::milliseconds(number);
+    else flush.batch_size = static_cast<size_t>(number);
+    return true;
+}
+
+static bool is_flush_option(const std::string& arg) {
+    return arg == "--min-latency" || arg == "--max-latency" || arg == "--batch-size";
+}
+
 static int cmd_exec(int argc, char* argv[]) {
     std::string db_path;
+    bool combine_regex = false;
+    bool separate_stderr = false;
+    clitheme::ExecOptions exec_options;
+    bool stats = false;
     int cmd_start = -1;
 
     for (int i = 2; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "--db-path" && i + 1 < argc) {
             db_path = argv[++i];
+        } else if (arg == "--combine-regex") {
+            combine_regex = true;
+        } else if (arg == "--separate-stderr") {
+            separate_stderr = true;
+        } else if (arg == "--threaded") {
+            exec_options.threaded = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (is_flush_option(arg) && i + 1 < argc) {
+            if (!parse_flush_option(arg, argv[++i], exec_options.flush)) return 1;
         } else if (arg[0] == '-') {
             std::cerr << "Unknown option: " << arg << "\n";
             return 1;
@@ -238,22 +324,47 @@ static int cmd_exec(int argc, char* argv[]) {
         clitheme::db_interface::set_db_path(db_path);
     }
 
+    std::vector<std::string> command_argv;
+    for (int i = cmd_start; i < argc; i++) {
+        command_argv.push_back(argv[i]);
+    }
+
+    // Load the substitution rules once for the whole session
+    std::string command_str = clitheme::string_utils::join(command_argv, " ");
+    std::optional<clitheme::RuleSet> stdout_rules;
+    std::optional<clitheme::RuleSet> stderr_rules;
     try {
         clitheme::db_interface::connect_db();
+        stdout_rules.emplace(command_str, false, combine_regex);
+        if (separate_stderr) stderr_rules.emplace(command_str, true, combine_regex);
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
+        clitheme::db_interface::close_db();
         return 1;
     }
+    const clitheme::RuleSet& rules = *stdout_rules;
+    if (stats) {
+        std::cerr << "clitheme-cpp: stats: rules: " << rules.size();
+        if (stderr_rules) std::cerr << " (stdout), " << stderr_rules->size() << " (stderr)";
+        std::cerr << "\n";
+    }
 
-    std::vector<std::string> command_argv;
-    for (int i = cmd_start; i < argc; i++) {
-        command_argv.push_back(argv[i]);
+    // Nothing to substitute: run the command in place, without the pty proxy
+    if (rules.empty() && (!stderr_rules || stderr_rules->empty())) {
+        if (stats) std::cerr << "clitheme-cpp: stats: path: direct exec (no rules apply)\n";
+        clitheme::db_interface::close_db();
+        return clitheme::ExecHandler::exec_direct(command_argv);
     }
 
     try {
-        clitheme::ExecHandler handler(command_argv);
+        clitheme::ExecHandler handler(command_argv, rules, stderr_rules ? &*stderr_rules : nullptr, exec_options);
         int exit_code = handler.run();
         clitheme::db_interface::close_db();
+        if (stats) {
+            print_exec_stats(handler, exec_options.threaded, separate_stderr);
+            print_slow_rules(rules);
+            if (stderr_rules) print_slow_rules(*stderr_rules);
+        }
         return exit_code;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
@@ -262,6 +373,77 @@ static int cmd_exec(int argc, char* argv[]) {
     }
 }
 
+static int cmd_filter(int argc, char* argv[]) {
+    std::string db_path;
+    std::optional<std::string> command;
+    bool is_stderr = false;
+    bool combine_regex = false;
+    clitheme::FlushOptions flush;
+    bool stats = false;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--db-path" && i + 1 < argc) {
+            db_path = argv[++i];
+        } else if (arg == "--command" && i + 1 < argc) {
+            command = argv[++i];
+        } else if (arg == "--stderr") {
+            is_stderr = true;
+        } else if (arg == "--combine-regex") {
+            combine_regex = true;
+        } else if (is_flush_option(arg) && i + 1 < argc) {
+            if (!parse_flush_option(arg, argv[++i], flush)) return 1;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (!db_path.empty()) {
+        clitheme::db_interface::set_db_path(db_path);
+    }
+
+    std::optional<clitheme::RuleSet> loaded_rules;
+    try {
+        clitheme::db_interface::connect_db();
+        loaded_rules.emplace(command, is_stderr, combine_regex);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        clitheme::db_interface::close_db();
+        return 1;
+    }
+    const clitheme::RuleSet& rules = *loaded_rules;
+
+    // Same line buffering as exec, without the pty. Pipes and files are made
+    // non-blocking for the channel. A terminal is left alone: its flags are shared
+    // with the shell, and the channel reads a blocking input only as far as it is ready.
+    const int fds[2] = {STDIN_FILENO, STDOUT_FILENO};
+    int saved_flags[2] = {-1, -1};
+    for (int i = 0; i < 2; i++) {
+        if (isatty(fds[i])) continue;
+        saved_flags[i] = fcntl(fds[i], F_GETFL);
+        if (saved_flags[i] != -1) fcntl(fds[i], F_SETFL, saved_flags[i] | O_NONBLOCK);
+    }
+    clitheme::OutputChannel channel(STDIN_FILENO, STDOUT_FILENO, rules, flush);
+    bool written = channel.run();
+    for (int i = 0; i < 2; i++) {
+        if (saved_flags[i] != -1) fcntl(fds[i], F_SETFL, saved_flags[i]);
+    }
+    if (stats) {
+        print_output_stats("stdin", channel.stats());
+        print_slow_rules(rules);
+    }
+
+    clitheme::db_interface::close_db();
+    if (!written) {
+        std::cerr << "Error: could not write output: " << std::strerror(channel.write_error()) << "\n";
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_usage();
@@ -273,6 +455,8 @@ int main(int argc, char* argv[]) {
         return cmd_generate(argc, argv);
     } else if (subcommand == "exec") {
         return cmd_exec(argc, argv);
+    } else if (subcommand == "filter") {
+        return cmd_filter(argc, argv);
     } else if (subcommand == "--help" || subcommand == "-h") {
         print_usage();
         return 0;
@@ -0,0 +1,60 @@
+#include "multiline_hold.hpp"
+#include "rule_set.hpp"
+#include "io_buffer.hpp"
+#include "line_index.hpp"
+#include "pcre2_regex.hpp"
+#include <algorithm>
+
+namespace clitheme {
+
+MultilineHold::MultilineHold(const RuleSet& rules, size_t window, std::chrono::milliseconds hold_time)
+    : rules_(rules), window_(window), hold_time_(hold_time) {
+    for (size_t i = 0; i < rules.size(); i++) {
+        if (rules.rules()[i].match_is_multiline && rules.pattern(i)) multiline_.push_back(i);
+    }
+}
+
+size_t MultilineHold::limit(const RingBuffer& buffer, size_t length, clock::time_point now) {
+    if (multiline_.empty() || length == 0) return length;
+    // Held long enough (new output did not complete the match either)
+    if (holding_ && now - held_since_ >= hold_time_) {
+        holding_ = false;
+        return length;
+    }
+
+    // The window starts at a line start, so that it is valid UTF-8 and ^ works
+    size_t window_start = length > window_ ? length - window_ : 0;
+    std::string tail = buffer.copy(window_start, length - window_start);
+    LineIndex lines(tail);
+    size_t search_start = 0;
+    if (window_start > 0) {
+        if (lines.size() < 2) return length;
+        search_start = lines.line_start(1);
+    }
+
+    size_t hold_start = std::string::npos;
+    for (size_t index : multiline_) {
+        if (rules_.is_slow(index)) continue;
+        // Undecided: hold from the start of the window
+        size_t start = pcre2_regex::partial_match_start(*rules_.pattern(index), tail, search_start)
+                           .value_or(search_start);
+        if (start < tail.size()) hold_start = std::min(hold_start, lines.line_start(lines.line_of(start)));
+        if (hold_start == search_start) break;
+    }
+    if (hold_start == std::string::npos) {
+        holding_ = false;
+        return length;
+    }
+
+    // Output held before is at the front of the buffer: unless it still is, this is a new hold
+    size_t process = window_start + hold_start;
+    if (!holding_ || process > 0) {
+        holding_ = true;
+        held_since_ = now;
+        count_++;
+    }
+    held_ = buffer.size() - process;
+    return process;
+}
+
+} // namespace clitheme
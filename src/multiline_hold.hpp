@@ -0,0 +1,47 @@
+#pragma once
+#include "globalvar.hpp"
+#include <chrono>
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+
+class RuleSet;
+class RingBuffer;
+
+// Keeps back the end of buffered output while a multiline rule may still match it
+// once more output arrives, so that the match is not split between two chunks.
+// PCRE2 partial matching over the last `window` bytes finds where such a match
+// could start; output from the start of that line on waits for at most hold_time.
+class MultilineHold {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit MultilineHold(const RuleSet& rules,
+                           size_t window = globalvar::exec_multiline_window,
+                           std::chrono::milliseconds hold_time =
+                               std::chrono::milliseconds(globalvar::exec_multiline_hold_ms));
+
+    // Of the first length bytes of buffer (ending at a line boundary or the buffer's end),
+    // how many to process now; the rest stays buffered
+    size_t limit(const RingBuffer& buffer, size_t length, clock::time_point now);
+    // Whether all of pending buffered bytes is held (no output arrived since)
+    bool holds_all(size_t pending) const { return holding_ && pending == held_; }
+    // When held output is processed anyway
+    clock::time_point deadline() const { return held_since_ + hold_time_; }
+    // Number of times output was held back
+    size_t count() const { return count_; }
+
+private:
+    const RuleSet& rules_;
+    // Indices of the multiline rules
+    std::vector<size_t> multiline_;
+    size_t window_;
+    clock::duration hold_time_;
+    bool holding_ = false;
+    size_t held_ = 0;
+    clock::time_point held_since_;
+    size_t count_ = 0;
+};
+
+} // namespace clitheme
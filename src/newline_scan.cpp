@@ -0,0 +1,167 @@
+#include "newline_scan.hpp"
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define CLITHEME_NEWLINE_SIMD 1
+#endif
+
+namespace clitheme {
+namespace newline_scan {
+
+// Scalar versions, also used for the tails of the vectorized ones
+
+static size_t find_next_scalar(const char* data, size_t size, size_t from) {
+    for (size_t i = from; i < size; i++) {
+        if (is_newline_byte(data[i])) return i;
+    }
+    return std::string::npos;
+}
+
+static size_t find_last_scalar(const char* data, size_t size) {
+    for (size_t i = size; i > 0; i--) {
+        if (is_newline_byte(data[i - 1])) return i - 1;
+    }
+    return std::string::npos;
+}
+
+// Record the newline byte at i (the "\r" of "\r\n" is left to the "\n")
+static inline void add_line_end(const char* data, size_t size, size_t i, std::vector<size_t>& ends) {
+    if (data[i] == '\r' && i + 1 < size && data[i + 1] == '\n') return;
+    ends.push_back(i + 1);
+}
+
+static void find_line_ends_scalar(const char* data, size_t size, size_t from, std::vector<size_t>& ends) {
+    for (size_t i = from; i < size; i++) {
+        if (is_newline_byte(data[i])) add_line_end(data, size, i, ends);
+    }
+}
+
+#ifdef CLITHEME_NEWLINE_SIMD
+
+// Newline bytes are 0x0a-0x0d and 0x1c-0x1e: x is one if (x - 0x0a) <= 3 or (x - 0x1c) <= 2
+// (unsigned), tested as min(d, limit) == d. Bit i of a mask is set for a newline at p[i].
+
+static inline uint32_t newline_mask_sse2(const char* p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i a = _mm_sub_epi8(v, _mm_set1_epi8(0x0a));
+    __m128i b = _mm_sub_epi8(v, _mm_set1_epi8(0x1c));
+    __m128i in_a = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(3)), a);
+    __m128i in_b = _mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(2)), b);
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(in_a, in_b)));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t newline_mask_avx2(const char* p) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i a = _mm256_sub_epi8(v, _mm256_set1_epi8(0x0a));
+    __m256i b = _mm256_sub_epi8(v, _mm256_set1_epi8(0x1c));
+    __m256i in_a = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(3)), a);
+    __m256i in_b = _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(2)), b);
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(in_a, in_b)));
+}
+
+static inline unsigned lowest_bit(uint32_t mask) { return static_cast<unsigned>(__builtin_ctz(mask)); }
+static inline unsigned highest_bit(uint32_t mask) { return 31u - static_cast<unsigned>(__builtin_clz(mask)); }
+
+static size_t find_next_sse2(const char* data, size_t size, size_t from) {
+    size_t i = from;
+    for (; i + 16 <= size; i += 16) {
+        uint32_t mask = newline_mask_sse2(data + i);
+        if (mask) return i + lowest_bit(mask);
+    }
+    return find_next_scalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_next_avx2(const char* data, size_t size, size_t from) {
+    size_t i = from;
+    for (; i + 32 <= size; i += 32) {
+        uint32_t mask = newline_mask_avx2(data + i);
+        if (mask) return i + lowest_bit(mask);
+    }
+    return find_next_sse2(data, size, i);
+}
+
+static size_t find_last_sse2(const char* data, size_t size) {
+    size_t i = size;
+    for (; i >= 16; i -= 16) {
+        uint32_t mask = newline_mask_sse2(data + i - 16);
+        if (mask) return i - 16 + highest_bit(mask);
+    }
+    return find_last_scalar(data, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_last_avx2(const char* data, size_t size) {
+    size_t i = size;
+    for (; i >= 32; i -= 32) {
+        uint32_t mask = newline_mask_avx2(data + i - 32);
+        if (mask) return i - 32 + highest_bit(mask);
+    }
+    return find_last_sse2(data, i);
+}
+
+static size_t find_line_ends_sse2(const char* data, size_t size, size_t from, std::vector<size_t>& ends) {
+    size_t i = from;
+    for (; i + 16 <= size; i += 16) {
+        for (uint32_t mask = newline_mask_sse2(data + i); mask; mask &= mask - 1) {
+            add_line_end(data, size, i + lowest_bit(mask), ends);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t find_line_ends_avx2(const char* data, size_t size, size_t from, std::vector<size_t>& ends) {
+    size_t i = from;
+    for (; i + 32 <= size; i += 32) {
+        for (uint32_t mask = newline_mask_avx2(data + i); mask; mask &= mask - 1) {
+            add_line_end(data, size, i + lowest_bit(mask), ends);
+        }
+    }
+    return i;
+}
+
+static bool use_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif // CLITHEME_NEWLINE_SIMD
+
+size_t find_next(const char* data, size_t size, size_t from) {
+#ifdef CLITHEME_NEWLINE_SIMD
+    return use_avx2() ? find_next_avx2(data, size, from) : find_next_sse2(data, size, from);
+#else
+    return find_next_scalar(data, size, from);
+#endif
+}
+
+size_t find_last(const char* data, size_t size) {
+#ifdef CLITHEME_NEWLINE_SIMD
+    return use_avx2() ? find_last_avx2(data, size) : find_last_sse2(data, size);
+#else
+    return find_last_scalar(data, size);
+#endif
+}
+
+void find_line_ends(const char* data, size_t size, std::vector<size_t>& ends) {
+    size_t i = 0;
+#ifdef CLITHEME_NEWLINE_SIMD
+    i = use_avx2() ? find_line_ends_avx2(data, size, 0, ends) : 0;
+    i = find_line_ends_sse2(data, size, i, ends);
+#endif
+    find_line_ends_scalar(data, size, i, ends);
+}
+
+const char* implementation() {
+#ifdef CLITHEME_NEWLINE_SIMD
+    return use_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace newline_scan
+} // namespace clitheme
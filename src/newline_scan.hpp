@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+namespace newline_scan {
+
+// Newline detection for the sequences in globalvar::newlines ("\r\n", "\r", "\n",
+// "\x0b", "\x0c", "\x1c", "\x1d", "\x1e"). Vectorized with AVX2 or SSE2 where
+// available (chosen at run time), scalar otherwise.
+
+// Whether c ends a newline sequence
+inline bool is_newline_byte(char c) {
+    return c == '\n' || c == '\r' || c == 0x0b || c == 0x0c || c == 0x1c || c == 0x1d || c == 0x1e;
+}
+
+// Offset of the first newline byte in data[from, size); npos if none
+size_t find_next(const char* data, size_t size, size_t from = 0);
+
+// Offset of the last newline byte in data[0, size); npos if none
+size_t find_last(const char* data, size_t size);
+
+// Append the offset just past every newline sequence in data[0, size) to ends
+// ("\r\n" counts as one sequence, so it only yields the offset after the "\n")
+void find_line_ends(const char* data, size_t size, std::vector<size_t>& ends);
+
+// Name of the implementation in use ("avx2", "sse2" or "scalar")
+const char* implementation();
+
+} // namespace newline_scan
+} // namespace clitheme
@@ -29,7 +29,7 @@ inline const std::vector<std::string> command_filter_options = {
 };
 inline const std::vector<std::string> substrules_options = {
     "subststdoutonly", "subststderronly", "substallstreams",
-    "endmatchhere", "foregroundonly", "nlmatchcurpos"
+    "endmatchhere", "foregroundonly", "nlmatchcurpos", "ignoreescapes"
 };
 
 // block_input_options = lead_indent_options + subst_options
@@ -46,16 +46,18 @@ inline const std::vector<std::string>& value_options = lead_indent_options;
 // Bool options (use no<...> to disable)
 inline std::vector<std::string> bool_options() {
     auto so = subst_options();
-    // Add substrules_options[3:] (endmatchhere, foregroundonly, nlmatchcurpos)
+    // Add substrules_options[3:] (endmatchhere, foregroundonly, nlmatchcurpos, ignoreescapes)
     so.push_back("endmatchhere");
     so.push_back("foregroundonly");
     so.push_back("nlmatchcurpos");
+    so.push_back("ignoreescapes");
     return so;
 }
 
 // Switch options: only one can be true at a time in each group
 inline const std::vector<std::vector<std::string>> switch_options = {
-    {"strictcmdmatch", "exactcmdmatch", "smartcmdmatch", "normalcmdmatch"}
+    {"strictcmdmatch", "exactcmdmatch", "smartcmdmatch", "normalcmdmatch"},
+    {"subststdoutonly", "subststderronly", "substallstreams"}
 };
 
 // substvar ban phrases
@@ -0,0 +1,192 @@
+#include "output_channel.hpp"
+#include "substrules_processor.hpp"
+#include "rule_set.hpp"
+#include "globalvar.hpp"
+#include "newline_scan.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+namespace clitheme {
+
+OutputChannel::OutputChannel(int input_fd, int output_fd, const RuleSet& rules,
+                             const FlushOptions& flush, TerminalState* terminal)
+    : input_fd_(input_fd),
+      input_blocking_(!(fcntl(input_fd, F_GETFL) & O_NONBLOCK)),
+      output_fd_(output_fd),
+      output_blocking_(!(fcntl(output_fd, F_GETFL) & O_NONBLOCK)),
+      terminal_(terminal),
+      rules_(rules),
+      open_(true),
+      buffer_(4096, globalvar::exec_output_buffer_cap),
+      has_complete_line_(false),
+      continues_line_(false),
+      policy_(flush),
+      hold_(rules),
+      last_input_(0),
+      write_error_(0) {}
+
+short OutputChannel::input_events() const {
+    return queue_.pending() < globalvar::exec_write_queue_limit ? POLLIN : 0;
+}
+
+FlushPolicy::clock::time_point OutputChannel::flush_deadline() const {
+    // While the output is behind, input is not read and no deadline applies
+    if (!input_events()) return FlushPolicy::clock::time_point::max();
+    if (hold_.holds_all(buffer_.size())) return hold_.deadline();
+    return policy_.deadline(buffer_.size(), has_complete_line_);
+}
+
+int OutputChannel::poll_timeout() const {
+    return FlushPolicy::timeout_until(FlushPolicy::clock::now(), flush_deadline());
+}
+
+void OutputChannel::note_input() {
+    last_input_.store(FlushPolicy::clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+OutputStats OutputChannel::stats() const {
+    OutputStats stats = stats_;
+    stats.flushes = policy_.stats();
+    stats.flushes.held = hold_.count();
+    return stats;
+}
+
+void OutputChannel::process(std::string chunk, bool cut) {
+    auto start = std::chrono::steady_clock::now();
+    bool foreground = !terminal_ || terminal_->child_in_foreground();
+    bool continues_line = continues_line_;
+    // The line goes on in the next chunk until a chunk ends it
+    continues_line_ = cut || (continues_line && newline_scan::find_last(chunk.data(), chunk.size()) == std::string::npos);
+    auto [processed, _] = substrules_processor::match_content(std::move(chunk), rules_, foreground, continues_line);
+    stats_.substitution_time += std::chrono::steady_clock::now() - start;
+    stats_.chunks++;
+    stats_.bytes_written += processed.size();
+    queue_.push(std::move(processed));
+}
+
+bool OutputChannel::read_input() {
+    for (bool first = true;; first = false) {
+        // A full buffer: process its complete lines, or what is decided if there is no newline
+        if (buffer_.space() == 0) {
+            size_t last_nl = buffer_.find_last_newline();
+            if (last_nl != std::string::npos) {
+                process(buffer_.take(last_nl + 1));
+            } else {
+                process_full_line();
+            }
+        }
+        // FIONREAD tells how much is ready, up to exec_read_size per read
+        int available = 0;
+        if (ioctl(input_fd_, FIONREAD, &available) == -1) available = 0;
+        // A blocking read past the first would wait for more input
+        if (input_blocking_ && !first && available <= 0) return true;
+        size_t want = available > 0 ? std::min<size_t>(available, globalvar::exec_read_size)
+                                    : globalvar::exec_read_size;
+        ssize_t n = buffer_.read_from(input_fd_, want);
+        if (n > 0) {
+            stats_.bytes_read += n;
+            if (static_cast<size_t>(n) < want) return true;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        return false; // EOF, or EIO once the child side is closed
+    }
+}
+
+void OutputChannel::process_full_line() {
+    std::string chunk = buffer_.take_all();
+    size_t length = substrules_processor::decided_length(chunk, rules_);
+    buffer_.append(chunk.data() + length, chunk.size() - length);
+    chunk.resize(length);
+    process(std::move(chunk), true);
+}
+
+void OutputChannel::flush() {
+    if (buffer_.empty() || !input_events()) return;
+    auto now = FlushPolicy::clock::now();
+    policy_.on_input(FlushPolicy::clock::time_point(
+        FlushPolicy::clock::duration(last_input_.load(std::memory_order_relaxed))));
+    size_t last_nl = buffer_.find_last_newline();
+    has_complete_line_ = last_nl != std::string::npos;
+    bool interactive = terminal_ && terminal_->is_raw();
+    auto action = policy_.decide(now, buffer_.size(), has_complete_line_, interactive);
+    if (action == FlushPolicy::Action::wait) return;
+
+    size_t length = action == FlushPolicy::Action::lines ? last_nl + 1 : buffer_.size();
+    // The start of a multiline match waits for the rest, unless the child is interactive
+    if (!interactive) length = hold_.limit(buffer_, length, now);
+    if (length > 0) process(buffer_.take(length));
+    has_complete_line_ = false;
+    policy_.on_processed(FlushPolicy::clock::now(), buffer_.size());
+    handle_output();
+}
+
+void OutputChannel::handle_input(short revents) {
+    if (!(revents & (POLLIN | POLLHUP | POLLERR))) return;
+    // After POLLHUP (child side closed) read_input has collected what is left
+    size_t before = stats_.bytes_read;
+    open_ = read_input() && !(revents & POLLHUP);
+    if (stats_.bytes_read != before) {
+        policy_.on_data(FlushPolicy::clock::now());
+        if (terminal_) terminal_->refresh();
+    }
+    flush();
+    handle_output();
+}
+
+void OutputChannel::handle_output() {
+    // Write what the output accepts now; the rest waits for POLLOUT
+    if (queue_.empty()) return;
+    bool was_behind = !input_events();
+    size_t limit = SIZE_MAX;
+    if (output_blocking_) {
+        // A blocking write could hold up the loop: write a bounded amount, and only when writable
+        struct pollfd pfd = {output_fd_, POLLOUT, 0};
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLOUT | POLLERR | POLLHUP))) return;
+        limit = globalvar::exec_blocking_write_size;
+    }
+    if (!queue_.flush(output_fd_, limit) && write_error_ == 0) write_error_ = errno;
+    // Waiting for the output is no pause in the input: restart the idle time
+    if (was_behind && input_events()) policy_.on_processed(FlushPolicy::clock::now(), buffer_.size());
+}
+
+void OutputChannel::handle_timeout() {
+    flush();
+}
+
+void OutputChannel::finish() {
+    if (!buffer_.empty()) process(buffer_.take_all());
+    if (!queue_.drain(output_fd_) && write_error_ == 0) write_error_ = errno;
+}
+
+bool OutputChannel::run() {
+    while (open_) {
+        struct pollfd fds[2];
+        int nfds = 0;
+        fds[nfds].fd = input_fd_;
+        fds[nfds].events = input_events();
+        nfds++;
+        if (has_pending_output()) {
+            fds[nfds].fd = output_fd_;
+            fds[nfds].events = POLLOUT;
+            nfds++;
+        }
+
+        int ret = poll(fds, nfds, poll_timeout());
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        handle_input(fds[0].revents);
+        if (nfds > 1 && fds[1].revents) handle_output();
+        handle_timeout();
+    }
+    finish();
+    return write_error_ == 0;
+}
+
+} // namespace clitheme
@@ -0,0 +1,100 @@
+#pragma once
+#include "io_buffer.hpp"
+#include "flush_policy.hpp"
+#include "multiline_hold.hpp"
+#include "terminal_state.hpp"
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace clitheme {
+
+class RuleSet;
+
+// Counters of one output stream (exec --stats)
+struct OutputStats {
+    size_t bytes_read = 0;
+    size_t bytes_written = 0; // After substitution
+    size_t chunks = 0;        // match_content calls
+    std::chrono::steady_clock::duration substitution_time{};
+    FlushStats flushes;
+};
+
+// One output stream of the child (stdout, or stderr in separate-stderr mode):
+// reads from a pty master, substitutes buffered output with the stream's rules
+// when the flush policy says so, and queues the result for its output file descriptor.
+class OutputChannel {
+public:
+    // rules must outlive the channel; both descriptors should be non-blocking. A blocking
+    // input (e.g. a terminal) is read once per poll wakeup, plus what FIONREAD reports;
+    // a blocking output gets at most exec_blocking_write_size bytes once it polls writable.
+    // terminal: the child's terminal, if any (must outlive the channel)
+    OutputChannel(int input_fd, int output_fd, const RuleSet& rules,
+                  const FlushOptions& flush = FlushOptions(), TerminalState* terminal = nullptr);
+
+    int input_fd() const { return input_fd_; }
+    int output_fd() const { return output_fd_; }
+    // False once the input reached end of file
+    bool is_open() const { return open_; }
+
+    // poll() events for input_fd (no POLLIN while too much output is queued)
+    short input_events() const;
+    bool has_pending_output() const { return !queue_.empty(); }
+    // When buffered output is due for processing (time_point::max(): none)
+    FlushPolicy::clock::time_point flush_deadline() const;
+    // poll() timeout in milliseconds this channel needs (-1: none)
+    int poll_timeout() const;
+
+    // Read what is ready, process what the flush policy allows and write what the output accepts
+    void handle_input(short revents);
+    // Output is writable
+    void handle_output();
+    // Process buffered output whose flush deadline has passed
+    void handle_timeout();
+    // Process what is left and wait until all output is written
+    void finish();
+    // User input was forwarded to the child (may be called from another thread)
+    void note_input();
+
+    OutputStats stats() const;
+
+    // Poll and handle this channel alone until its input ends (for a channel on its own thread).
+    // Returns false if some output could not be written.
+    bool run();
+    // errno of the first failed write to output_fd (0: none); the output is dropped from there
+    int write_error() const { return write_error_; }
+
+private:
+    // Read everything ready; returns false at end of file
+    bool read_input();
+    // cut: the chunk ends in the middle of a line because the buffer was full
+    void process(std::string chunk, bool cut = false);
+    // A full buffer without a newline: process what no rule can still match across, keep the rest
+    void process_full_line();
+    // Ask the flush policy and process accordingly
+    void flush();
+
+    int input_fd_;
+    bool input_blocking_;
+    int output_fd_;
+    bool output_blocking_;
+    TerminalState* terminal_;
+    const RuleSet& rules_;
+    bool open_;
+    // Unprocessed input
+    RingBuffer buffer_;
+    bool has_complete_line_;
+    // The next chunk continues a line that was cut (see process)
+    bool continues_line_;
+    WriteQueue queue_;
+    FlushPolicy policy_;
+    MultilineHold hold_;
+    // steady_clock time of the last note_input(), in nanoseconds since its epoch
+    std::atomic<int64_t> last_input_;
+    int write_error_;
+    OutputStats stats_;
+};
+
+} // namespace clitheme
@@ -0,0 +1,176 @@
+#include "output_pipeline.hpp"
+#include "substrules_processor.hpp"
+#include "io_buffer.hpp"
+#include "globalvar.hpp"
+#include "newline_scan.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+namespace clitheme {
+
+// Signals are handled by the thread that started the pipeline (SIGPIPE stays
+// with the writer, so a closed output still ends the process)
+static void block_signals() {
+    sigset_t signals;
+    sigfillset(&signals);
+    sigdelset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+OutputPipeline::OutputPipeline(int input_fd, int output_fd, const RuleSet& rules,
+                               const FlushOptions& flush, TerminalState* terminal)
+    : input_fd_(input_fd), output_fd_(output_fd), terminal_(terminal), rules_(rules),
+      policy_(flush), hold_(rules), last_input_(0), done_fd_(-1),
+      input_queue_(globalvar::exec_pipeline_queue_length),
+      output_queue_(globalvar::exec_pipeline_queue_length) {
+    done_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (done_fd_ == -1) {
+        throw std::runtime_error("eventfd failed: " + std::string(strerror(errno)));
+    }
+    writer_ = std::thread([this]() { block_signals(); write_loop(); });
+    worker_ = std::thread([this]() { block_signals(); substitute_loop(); });
+    reader_ = std::thread([this]() { block_signals(); read_loop(); });
+}
+
+OutputPipeline::~OutputPipeline() {
+    finish();
+    close(done_fd_);
+}
+
+void OutputPipeline::finish() {
+    if (reader_.joinable()) reader_.join();
+    if (worker_.joinable()) worker_.join();
+    if (writer_.joinable()) writer_.join();
+}
+
+void OutputPipeline::note_input() {
+    last_input_.store(FlushPolicy::clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+OutputStats OutputPipeline::stats() const {
+    OutputStats stats = stats_;
+    stats.flushes = policy_.stats();
+    stats.flushes.held = hold_.count();
+    return stats;
+}
+
+void OutputPipeline::read_loop() {
+    RingBuffer buffer(4096, globalvar::exec_output_buffer_cap);
+    bool has_complete_line = false;
+    bool open = true;
+    while (open) {
+        struct pollfd pfd = {input_fd_, POLLIN, 0};
+        auto now = FlushPolicy::clock::now();
+        int timeout = hold_.holds_all(buffer.size())
+            ? FlushPolicy::timeout_until(now, hold_.deadline())
+            : policy_.poll_timeout(now, buffer.size(), has_complete_line);
+        int ret = poll(&pfd, 1, timeout);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            size_t before = stats_.bytes_read;
+            // Read everything ready (see OutputChannel::read_input)
+            while (true) {
+                if (buffer.space() == 0) {
+                    size_t last_nl = buffer.find_last_newline();
+                    if (last_nl != std::string::npos) {
+                        input_queue_.push({buffer.take(last_nl + 1)});
+                    } else {
+                        // See OutputChannel::process_full_line
+                        std::string chunk = buffer.take_all();
+                        size_t length = substrules_processor::decided_length(chunk, rules_);
+                        buffer.append(chunk.data() + length, chunk.size() - length);
+                        chunk.resize(length);
+                        input_queue_.push({std::move(chunk), true});
+                    }
+                }
+                int available = 0;
+                if (ioctl(input_fd_, FIONREAD, &available) == -1) available = 0;
+                size_t want = available > 0 ? std::min<size_t>(available, globalvar::exec_read_size)
+                                            : globalvar::exec_read_size;
+                ssize_t n = buffer.read_from(input_fd_, want);
+                if (n > 0) {
+                    stats_.bytes_read += n;
+                    if (static_cast<size_t>(n) < want) break;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                open = false; // EOF, or EIO once the child side is closed
+                break;
+            }
+            if (pfd.revents & POLLHUP) open = false;
+            if (stats_.bytes_read != before) {
+                policy_.on_data(FlushPolicy::clock::now());
+                if (terminal_) terminal_->refresh();
+            }
+        }
+
+        // Hand over what the flush policy allows (see OutputChannel::flush)
+        if (buffer.empty()) continue;
+        policy_.on_input(FlushPolicy::clock::time_point(
+            FlushPolicy::clock::duration(last_input_.load(std::memory_order_relaxed))));
+        size_t last_nl = buffer.find_last_newline();
+        has_complete_line = last_nl != std::string::npos;
+        bool interactive = terminal_ && terminal_->is_raw();
+        now = FlushPolicy::clock::now();
+        auto action = policy_.decide(now, buffer.size(), has_complete_line, interactive);
+        if (action == FlushPolicy::Action::wait) continue;
+        size_t length = action == FlushPolicy::Action::lines ? last_nl + 1 : buffer.size();
+        // See OutputChannel::flush
+        if (!interactive) length = hold_.limit(buffer, length, now);
+        if (length > 0) input_queue_.push({buffer.take(length)});
+        has_complete_line = false;
+        policy_.on_processed(FlushPolicy::clock::now(), buffer.size());
+    }
+    if (!buffer.empty()) input_queue_.push({buffer.take_all()});
+    input_queue_.close();
+    uint64_t one = 1;
+    ssize_t written = write(done_fd_, &one, sizeof(one));
+    (void)written;
+}
+
+void OutputPipeline::substitute_loop() {
+    Chunk chunk;
+    bool continues_line = false;
+    while (input_queue_.pop(chunk)) {
+        auto start = std::chrono::steady_clock::now();
+        bool foreground = !terminal_ || terminal_->child_in_foreground();
+        // See OutputChannel::process
+        bool continued = continues_line;
+        continues_line = chunk.cut ||
+            (continued && newline_scan::find_last(chunk.data.data(), chunk.data.size()) == std::string::npos);
+        auto [processed, _] = substrules_processor::match_content(std::move(chunk.data), rules_, foreground, continued);
+        stats_.substitution_time += std::chrono::steady_clock::now() - start;
+        stats_.chunks++;
+        stats_.bytes_written += processed.size();
+        output_queue_.push(std::move(processed));
+    }
+    output_queue_.close();
+}
+
+void OutputPipeline::write_loop() {
+    WriteQueue queue;
+    std::string data;
+    while (output_queue_.pop(data)) {
+        queue.push(std::move(data));
+        // Collect whatever else is ready into the same writev
+        while (queue.pending() < globalvar::exec_write_queue_limit && output_queue_.try_pop(data)) {
+            queue.push(std::move(data));
+        }
+        queue.drain(output_fd_);
+    }
+}
+
+} // namespace clitheme
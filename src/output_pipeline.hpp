@@ -0,0 +1,67 @@
+#pragma once
+#include "spsc_ring.hpp"
+#include "output_channel.hpp"
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+namespace clitheme {
+
+class RuleSet;
+
+// Threaded counterpart of OutputChannel: a reader, a substitution worker and a
+// writer thread, connected by bounded SPSC queues. The reader hands over chunks
+// as the flush policy decides (see OutputChannel), so substitution overlaps with reading and writing instead of holding them up.
+class OutputPipeline {
+public:
+    // rules must outlive the pipeline; both descriptors should be non-blocking.
+    // terminal: the child's terminal, if any (must outlive the pipeline)
+    OutputPipeline(int input_fd, int output_fd, const RuleSet& rules,
+                   const FlushOptions& flush = FlushOptions(), TerminalState* terminal = nullptr);
+    // Waits for the threads (see finish)
+    ~OutputPipeline();
+
+    OutputPipeline(const OutputPipeline&) = delete;
+    OutputPipeline& operator=(const OutputPipeline&) = delete;
+
+    // Descriptor that becomes readable once the input has ended
+    int done_fd() const { return done_fd_; }
+    // Wait until everything read has been written and the threads have exited
+    void finish();
+    // User input was forwarded to the child
+    void note_input();
+    // Complete once finish() has returned
+    OutputStats stats() const;
+
+private:
+    void read_loop();
+    void substitute_loop();
+    void write_loop();
+
+    int input_fd_;
+    int output_fd_;
+    TerminalState* terminal_;
+    const RuleSet& rules_;
+    // Used by the reader
+    FlushPolicy policy_;
+    MultilineHold hold_;
+    // steady_clock time of the last note_input(), in nanoseconds since its epoch
+    std::atomic<int64_t> last_input_;
+    int done_fd_;
+    // Read chunks: each ends at a line boundary unless the policy flushed an incomplete line
+    struct Chunk {
+        std::string data;
+        // Ends in the middle of a line because the read buffer was full
+        bool cut = false;
+    };
+    SpscRing<Chunk> input_queue_;
+    SpscRing<std::string> output_queue_;
+    std::thread reader_;
+    std::thread worker_;
+    std::thread writer_;
+    // bytes_read is counted by the reader, the rest by the worker
+    OutputStats stats_;
+};
+
+} // namespace clitheme
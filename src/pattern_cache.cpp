@@ -0,0 +1,265 @@
+#include "pattern_cache.hpp"
+#include "globalvar.hpp"
+#include "pcre2_regex.hpp"
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace clitheme {
+namespace pattern_cache {
+
+// Cache file layout:
+//   FileHeader, database path, then pattern_count entries of
+//   [uint32 options][uint32 length][pattern text], padding to 8 bytes,
+//   then the pcre2_serialize_encode() blob (codes in entry order).
+//   The header checksum covers everything after the header.
+static const char cache_magic[8] = {'C', 'T', 'P', 'C', 'A', 'C', 'H', 'E'};
+constexpr uint32_t cache_format_version = 1;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t format_version;
+    int32_t db_version;
+    uint64_t db_size;
+    int64_t db_mtime_sec;
+    int64_t db_mtime_nsec;
+    uint32_t path_length;
+    uint32_t pattern_count;
+    uint64_t blob_size;
+    uint64_t checksum;
+};
+
+// Identity of the database the cache was built from
+struct DbKey {
+    std::string path;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+// Patterns known to be in the cache file, per database path
+static std::string loaded_path;
+static std::set<PatternKey> loaded_patterns;
+
+static bool get_db_key(const std::string& db_path, DbKey& key) {
+    struct stat st;
+    if (stat(db_path.c_str(), &st) != 0) return false;
+    std::error_code ec;
+    fs::path abs = fs::absolute(db_path, ec);
+    key.path = ec ? db_path : abs.lexically_normal().string();
+    key.size = static_cast<uint64_t>(st.st_size);
+    key.mtime_sec = st.st_mtim.tv_sec;
+    key.mtime_nsec = st.st_mtim.tv_nsec;
+    return true;
+}
+
+// FNV-1a, used for the cache file name and the payload checksum
+static uint64_t fnv1a(const unsigned char* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+std::string get_cache_path(const std::string& db_path) {
+    DbKey key;
+    std::string path = get_db_key(db_path, key) ? key.path : db_path;
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(
+        fnv1a(reinterpret_cast<const unsigned char*>(path.data()), path.size())));
+    return globalvar::get_root_data_path() + "/" + globalvar::pattern_cache_pathname + "/" + name;
+}
+
+// RAII read-only mapping of a whole file
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data = static_cast<const unsigned char*>(p);
+                size = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+size_t load(const std::string& db_path) {
+    DbKey key;
+    if (!get_db_key(db_path, key)) return 0;
+    if (key.path == loaded_path) return 0; // Already loaded in this process
+
+    MappedFile file(get_cache_path(db_path));
+    if (file.data == nullptr || file.size < sizeof(FileHeader)) return 0;
+
+    FileHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.format_version != cache_format_version ||
+        header.db_version != globalvar::db_version ||
+        header.db_size != key.size ||
+        header.db_mtime_sec != key.mtime_sec ||
+        header.db_mtime_nsec != key.mtime_nsec) {
+        return 0; // Stale
+    }
+    if (fnv1a(file.data + sizeof(FileHeader), file.size - sizeof(FileHeader)) != header.checksum) {
+        return 0; // Corrupt
+    }
+
+    // Parse the variable-length part, bounds-checking everything
+    size_t pos = sizeof(FileHeader);
+    auto available = [&](size_t n) { return pos <= file.size && file.size - pos >= n; };
+
+    if (!available(header.path_length)) return 0;
+    std::string path(reinterpret_cast<const char*>(file.data + pos), header.path_length);
+    pos += header.path_length;
+    if (path != key.path) return 0; // File name hash collision
+
+    std::vector<PatternKey> patterns;
+    patterns.reserve(header.pattern_count);
+    for (uint32_t i = 0; i < header.pattern_count; i++) {
+        uint32_t options, length;
+        if (!available(2 * sizeof(uint32_t))) return 0;
+        std::memcpy(&options, file.data + pos, sizeof(uint32_t));
+        std::memcpy(&length, file.data + pos + sizeof(uint32_t), sizeof(uint32_t));
+        pos += 2 * sizeof(uint32_t);
+        if (!available(length)) return 0;
+        patterns.emplace_back(std::string(reinterpret_cast<const char*>(file.data + pos), length), options);
+        pos += length;
+    }
+    pos = align8(pos);
+    if (header.pattern_count == 0 || !available(header.blob_size)) return 0;
+
+    const uint8_t* blob = file.data + pos;
+    if (pcre2_serialize_get_number_of_codes(blob) != static_cast<int32_t>(header.pattern_count)) return 0;
+
+    std::vector<pcre2_code*> codes(header.pattern_count, nullptr);
+    int32_t rc = pcre2_serialize_decode(codes.data(), header.pattern_count, blob, nullptr);
+    if (rc != static_cast<int32_t>(header.pattern_count)) {
+        for (auto* code : codes) if (code) pcre2_code_free(code);
+        return 0; // Corrupt, or written by an incompatible PCRE2 build
+    }
+
+    loaded_path = key.path;
+    loaded_patterns.clear();
+    for (size_t i = 0; i < patterns.size(); i++) {
+        pcre2_regex::add_pattern(patterns[i].first, patterns[i].second,
+            std::make_shared<const pcre2_regex::CompiledPattern>(codes[i], true));
+        loaded_patterns.insert(patterns[i]);
+    }
+    return patterns.size();
+}
+
+void save(const std::string& db_path, const std::vector<PatternKey>& patterns) {
+    DbKey key;
+    if (!get_db_key(db_path, key)) return;
+    if (key.path != loaded_path) {
+        loaded_path = key.path;
+        loaded_patterns.clear();
+    }
+
+    bool missing = false;
+    for (const auto& p : patterns) {
+        if (!loaded_patterns.count(p)) { missing = true; break; }
+    }
+    if (!missing) return;
+
+    // Collect the compiled code of everything that should be on disk
+    std::set<PatternKey> all_patterns = loaded_patterns;
+    all_patterns.insert(patterns.begin(), patterns.end());
+    std::vector<PatternKey> entries;
+    std::vector<pcre2_regex::PatternHandle> handles;
+    std::vector<const pcre2_code*> codes;
+    for (const auto& p : all_patterns) {
+        auto handle = pcre2_regex::find_pattern(p.first, p.second);
+        if (!handle) continue;
+        entries.push_back(p);
+        codes.push_back(handle->code());
+        handles.push_back(std::move(handle));
+    }
+    if (codes.empty()) return;
+
+    uint8_t* blob = nullptr;
+    PCRE2_SIZE blob_size = 0;
+    if (pcre2_serialize_encode(codes.data(), static_cast<int32_t>(codes.size()),
+                               &blob, &blob_size, nullptr) < 0) {
+        return;
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.format_version = cache_format_version;
+    header.db_version = globalvar::db_version;
+    header.db_size = key.size;
+    header.db_mtime_sec = key.mtime_sec;
+    header.db_mtime_nsec = key.mtime_nsec;
+    header.path_length = static_cast<uint32_t>(key.path.size());
+    header.pattern_count = static_cast<uint32_t>(entries.size());
+    header.blob_size = blob_size;
+
+    std::string data(sizeof(header), '\0');
+    data += key.path;
+    for (const auto& entry : entries) {
+        uint32_t options = entry.second;
+        uint32_t length = static_cast<uint32_t>(entry.first.size());
+        data.append(reinterpret_cast<const char*>(&options), sizeof(options));
+        data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        data += entry.first;
+    }
+    data.resize(align8(data.size()), '\0');
+    data.append(reinterpret_cast<const char*>(blob), blob_size);
+    pcre2_serialize_free(blob);
+    header.checksum = fnv1a(reinterpret_cast<const unsigned char*>(data.data()) + sizeof(header),
+                            data.size() - sizeof(header));
+    std::memcpy(&data[0], &header, sizeof(header));
+
+    // Write to a temporary file and rename, so readers never see a partial file
+    std::string cache_path = get_cache_path(db_path);
+    std::error_code ec;
+    fs::create_directories(fs::path(cache_path).parent_path(), ec);
+    if (ec) return;
+    std::string temp_path = cache_path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) return;
+        ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!ofs) {
+            ofs.close();
+            fs::remove(temp_path, ec);
+            return;
+        }
+    }
+    fs::rename(temp_path, cache_path, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return;
+    }
+    loaded_patterns.insert(entries.begin(), entries.end());
+}
+
+} // namespace pattern_cache
+} // namespace clitheme
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace clitheme {
+namespace pattern_cache {
+
+// (pattern text, compile options), the pcre2_regex pattern cache key
+using PatternKey = std::pair<std::string, uint32_t>;
+
+// Get the cache file path for a database
+std::string get_cache_path(const std::string& db_path);
+
+// Decode the serialized patterns cached for db_path into the pcre2_regex pattern cache.
+// The cache file is ignored if it is missing, corrupt, or stale (the database path,
+// mtime, size or db_version changed). Returns the number of patterns loaded.
+size_t load(const std::string& db_path);
+
+// Rewrite the cache file for db_path with the given patterns plus the ones loaded
+// earlier by load(). Patterns must already be in the pcre2_regex cache.
+// Does nothing if all of them are already on disk; write errors are ignored.
+void save(const std::string& db_path, const std::vector<PatternKey>& patterns);
+
+} // namespace pattern_cache
+} // namespace clitheme
@@ -1,6 +1,10 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include "pcre2_regex.hpp"
+#include "string_utils.hpp"
+#include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <mutex>
 
 namespace clitheme {
 namespace pcre2_regex {
@@ -12,39 +16,6 @@ static std::string pcre2_error_message(int errorcode) {
     return reinterpret_cast<const char*>(buffer);
 }
 
-// RAII wrapper for pcre2_code
-struct CompiledPattern {
-    pcre2_code* code;
-    CompiledPattern(const std::string& pattern, uint32_t options = 0) {
-        int errorcode;
-        PCRE2_SIZE erroroffset;
-        code = pcre2_compile(
-            reinterpret_cast<PCRE2_SPTR>(pattern.c_str()),
-            pattern.size(),
-            options | PCRE2_UTF | PCRE2_MULTILINE,
-            &errorcode, &erroroffset, nullptr);
-        if (code == nullptr) {
-            throw regex_error(pcre2_error_message(errorcode));
-        }
-    }
-    ~CompiledPattern() { if (code) pcre2_code_free(code); }
-    CompiledPattern(const CompiledPattern&) = delete;
-    CompiledPattern& operator=(const CompiledPattern&) = delete;
-};
-
-void validate_pattern(const std::string& pattern) {
-    CompiledPattern cp(pattern);
-}
-
-void validate_substitution(const std::string& pattern, const std::string& replacement) {
-    CompiledPattern cp(pattern);
-    // Try a substitution on empty string to validate replacement syntax
-    pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(cp.code, nullptr);
-    // Just try matching - replacement validation happens at expand time
-    pcre2_match(cp.code, reinterpret_cast<PCRE2_SPTR>(""), 0, 0, 0, match_data, nullptr);
-    pcre2_match_data_free(match_data);
-}
-
 // Extract named groups mapping from compiled pattern
 static std::map<std::string, int> extract_named_groups(pcre2_code* code) {
     std::map<std::string, int> named_groups;
@@ -65,68 +36,707 @@ static std::map<std::string, int> extract_named_groups(pcre2_code* code) {
     return named_groups;
 }
 
-static Match build_match(pcre2_code* code, pcre2_match_data* match_data,
-                          const std::string& subject) {
-    Match m;
-    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
-    uint32_t count = pcre2_get_ovector_count(match_data);
+CompiledPattern::CompiledPattern(const std::string& pattern, uint32_t options, bool use_jit)
+    : code_(nullptr), use_jit_(use_jit), jit_(false) {
+    int errorcode;
+    PCRE2_SIZE erroroffset;
+    code_ = pcre2_compile(
+        reinterpret_cast<PCRE2_SPTR>(pattern.c_str()),
+        pattern.size(),
+        options | PCRE2_UTF | PCRE2_MULTILINE,
+        &errorcode, &erroroffset, nullptr);
+    if (code_ == nullptr) {
+        throw regex_error(pcre2_error_message(errorcode));
+    }
+    named_groups_ = extract_named_groups(code_);
+}
+
+CompiledPattern::CompiledPattern(pcre2_code* code, bool use_jit)
+    : code_(code), use_jit_(use_jit), jit_(false) {
+    named_groups_ = extract_named_groups(code_);
+}
+
+void CompiledPattern::ensure_jit() const {
+    if (!use_jit_) return;
+    std::call_once(jit_once_, [this]() {
+        // Partial matching (partial_match_start) runs JIT code as well
+        jit_ = pcre2_jit_compile(code_, PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_HARD) == 0;
+    });
+}
+
+CompiledPattern::~CompiledPattern() { if (code_) pcre2_code_free(code_); }
+
+// Per-thread match context with a JIT stack, sized once per thread
+struct JitContext {
+    pcre2_jit_stack* stack;
+    pcre2_match_context* mcontext;
+    JitContext() {
+        stack = pcre2_jit_stack_create(32 * 1024, 4 * 1024 * 1024, nullptr);
+        mcontext = pcre2_match_context_create(nullptr);
+        if (stack && mcontext) pcre2_jit_stack_assign(mcontext, nullptr, stack);
+    }
+    ~JitContext() {
+        if (mcontext) pcre2_match_context_free(mcontext);
+        if (stack) pcre2_jit_stack_free(stack);
+    }
+    JitContext(const JitContext&) = delete;
+    JitContext& operator=(const JitContext&) = delete;
+};
+
+static pcre2_match_context* thread_match_context() {
+    thread_local JitContext ctx;
+    return ctx.mcontext;
+}
+
+void set_match_limits(uint32_t match_limit, uint32_t heap_limit_kib) {
+    pcre2_match_context* mcontext = thread_match_context();
+    if (!mcontext) return;
+    pcre2_set_match_limit(mcontext, match_limit);
+    pcre2_set_heap_limit(mcontext, heap_limit_kib);
+}
+
+void reset_match_limits() {
+    // PCRE2's built-in defaults
+    set_match_limits(10000000, 20000000);
+}
+
+// Process-wide compiled pattern cache: (pattern, options) -> compiled pattern
+static std::mutex pattern_cache_mutex;
+static std::map<std::pair<std::string, uint32_t>, PatternHandle> pattern_cache;
+
+PatternHandle get_pattern(const std::string& pattern, uint32_t options) {
+    auto key = std::make_pair(pattern, options);
+    {
+        std::lock_guard<std::mutex> lock(pattern_cache_mutex);
+        auto it = pattern_cache.find(key);
+        if (it != pattern_cache.end()) return it->second;
+    }
+    // Compile outside the lock; a concurrent compile of the same pattern is harmless
+    auto compiled = std::make_shared<const CompiledPattern>(pattern, options, true);
+    std::lock_guard<std::mutex> lock(pattern_cache_mutex);
+    return pattern_cache.emplace(std::move(key), std::move(compiled)).first->second;
+}
+
+PatternHandle find_pattern(const std::string& pattern, uint32_t options) {
+    std::lock_guard<std::mutex> lock(pattern_cache_mutex);
+    auto it = pattern_cache.find(std::make_pair(pattern, options));
+    return it != pattern_cache.end() ? it->second : nullptr;
+}
+
+void add_pattern(const std::string& pattern, uint32_t options, PatternHandle compiled) {
+    std::lock_guard<std::mutex> lock(pattern_cache_mutex);
+    pattern_cache[std::make_pair(pattern, options)] = std::move(compiled);
+}
+
+void clear_pattern_cache() {
+    std::lock_guard<std::mutex> lock(pattern_cache_mutex);
+    pattern_cache.clear();
+}
+
+void validate_pattern(const std::string& pattern) {
+    CompiledPattern cp(pattern);
+}
+
+void validate_substitution(const std::string& pattern, const std::string& replacement) {
+    CompiledPattern cp(pattern);
+    // Try a substitution on empty string to validate replacement syntax
+    pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(cp.code(), nullptr);
+    // Just try matching - replacement validation happens at expand time
+    pcre2_match(cp.code(), reinterpret_cast<PCRE2_SPTR>(""), 0, 0, 0, match_data, nullptr);
+    pcre2_match_data_free(match_data);
+}
+
+// Required literal extraction. The parser is deliberately conservative: anything it
+// does not fully understand either breaks the current literal run or gives up.
+
+// Byte length of the UTF-8 character starting with lead byte c
+static size_t utf8_char_length(unsigned char c) {
+    if (c >= 0xF0) return 4;
+    if (c >= 0xE0) return 3;
+    if (c >= 0xC0) return 2;
+    return 1;
+}
+
+// Option letters of "(?letters)" or "(?letters:" starting at pos (the '(');
+// npos if this is not an option setting or group
+static size_t option_letters_end(const std::string& p, size_t pos) {
+    size_t i = pos + 2;
+    while (i < p.size() && (std::isalpha(static_cast<unsigned char>(p[i])) || p[i] == '^' || p[i] == '-')) i++;
+    if (i == pos + 2 || i >= p.size() || (p[i] != ')' && p[i] != ':')) return std::string::npos;
+    return i;
+}
+
+// Index past the end of the \Q...\E sequence whose \Q is at pos
+static size_t skip_quoted(const std::string& p, size_t pos) {
+    size_t end = p.find("\\E", pos + 2);
+    return end == std::string::npos ? p.size() : end + 2;
+}
+
+// Index past the ']' closing the character class at pos; npos on failure
+static size_t skip_class(const std::string& p, size_t pos) {
+    size_t i = pos + 1;
+    if (i < p.size() && p[i] == '^') i++;
+    if (i < p.size() && p[i] == ']') i++; // Leading ']' is a literal
+    while (i < p.size()) {
+        if (p.compare(i, 2, "\\Q") == 0) { i = skip_quoted(p, i); continue; }
+        if (p[i] == '\\') { i += 2; continue; }
+        if (p[i] == '[' && i + 1 < p.size() && (p[i + 1] == ':' || p[i + 1] == '.' || p[i + 1] == '=')) {
+            size_t end = p.find(std::string(1, p[i + 1]) + "]", i + 2);
+            if (end == std::string::npos) return std::string::npos;
+            i = end + 2;
+            continue;
+        }
+        if (p[i] == ']') return i + 1;
+        i++;
+    }
+    return std::string::npos;
+}
+
+// Index past the ')' closing the group at pos; npos on failure or if the group
+// switches on extended mode (comments could hide parentheses)
+static size_t skip_group(const std::string& p, size_t pos) {
+    int depth = 0;
+    size_t i = pos;
+    while (i < p.size()) {
+        char c = p[i];
+        if (p.compare(i, 2, "\\Q") == 0) { i = skip_quoted(p, i); continue; }
+        if (c == '\\') { i += 2; continue; }
+        if (c == '[') {
+            i = skip_class(p, i);
+            if (i == std::string::npos) return i;
+            continue;
+        }
+        if (c == '(') {
+            if (p.compare(i, 3, "(?#") == 0) {
+                size_t end = p.find(')', i);
+                if (end == std::string::npos) return end;
+                i = end + 1;
+                continue;
+            }
+            if (i + 1 < p.size() && p[i + 1] == '?') {
+                size_t end = option_letters_end(p, i);
+                if (end != std::string::npos && p.substr(i + 2, end - i - 2).find('x') != std::string::npos)
+                    return std::string::npos;
+            }
+            depth++;
+        } else if (c == ')') {
+            if (--depth == 0) return i + 1;
+        }
+        i++;
+    }
+    return std::string::npos;
+}
+
+// Parse a quantifier at pos; sets min_count and returns the index past it
+// (including a possessive/lazy suffix), or pos if there is none
+static size_t parse_quantifier(const std::string& p, size_t pos, unsigned long& min_count) {
+    if (pos >= p.size()) return pos;
+    size_t i = pos;
+    char c = p[i];
+    if (c == '?' || c == '*') {
+        min_count = 0;
+        i++;
+    } else if (c == '+') {
+        min_count = 1;
+        i++;
+    } else if (c == '{') {
+        size_t end = p.find('}', i);
+        if (end == std::string::npos) return pos;
+        std::string body = p.substr(i + 1, end - i - 1);
+        if (body.empty() || body.find_first_not_of("0123456789, ") != std::string::npos) return pos;
+        // Anything that might be a quantifier is treated as one; a leading count is its minimum
+        size_t first = body.find_first_not_of(' ');
+        min_count = (first != std::string::npos && std::isdigit(static_cast<unsigned char>(body[first])))
+            ? std::stoul(body.substr(first)) : 0;
+        i = end + 1;
+    } else {
+        return pos;
+    }
+    if (i < p.size() && (p[i] == '+' || p[i] == '?')) i++;
+    return i;
+}
+
+// Split pattern into the literal runs every match contains, in pattern order.
+// exact is set if the whole pattern is one plain literal. Returns false if the
+// pattern cannot be analysed.
+static bool parse_literal_runs(const std::string& p, std::vector<std::string>& runs, bool& exact) {
+    runs.clear();
+    exact = true;
+    // (*ACCEPT) can end a match before the rest of the pattern
+    if (p.find("(*ACCEPT") != std::string::npos) return false;
+
+    std::string run;
+    size_t last_atom = 0; // Byte length of the last literal character in run (0: none)
+    auto end_run = [&]() {
+        if (!run.empty()) runs.push_back(run);
+        run.clear();
+        last_atom = 0;
+        exact = false;
+    };
+
+    size_t i = 0;
+    while (i < p.size()) {
+        unsigned long min_count = 1;
+        size_t next = parse_quantifier(p, i, min_count);
+        if (next != i) {
+            i = next;
+            exact = false;
+            if (last_atom == 0) continue; // Quantifier on a group, class or assertion
+            // The repeated character may be absent, or repeated: either way nothing can follow it
+            if (min_count == 0) run.resize(run.size() - last_atom);
+            end_run();
+            continue;
+        }
+
+        char c = p[i];
+        bool literal = false;
+        std::string atom;
+
+        if (c == '|') {
+            return false; // Top-level alternative
+        } else if (c == '(') {
+            if (p.compare(i, 3, "(?#") == 0) {
+                size_t end = p.find(')', i);
+                if (end == std::string::npos) return false;
+                end_run();
+                i = end + 1;
+                continue;
+            }
+            if (i + 1 < p.size() && p[i + 1] == '?') {
+                size_t end = option_letters_end(p, i);
+                if (end != std::string::npos) {
+                    std::string letters = p.substr(i + 2, end - i - 2);
+                    if (letters.find('x') != std::string::npos) return false;
+                    // Caseless matching for the rest of the pattern
+                    if (p[end] == ')' && letters.find('i') != std::string::npos) return false;
+                }
+            }
+            size_t end = skip_group(p, i);
+            if (end == std::string::npos) return false;
+            end_run();
+            i = end;
+        } else if (c == '[') {
+            size_t end = skip_class(p, i);
+            if (end == std::string::npos) return false;
+            end_run();
+            i = end;
+        } else if (c == '\\') {
+            if (i + 1 >= p.size()) return false;
+            char e = p[i + 1];
+            if (e == 'Q') {
+                size_t end = p.find("\\E", i + 2);
+                size_t stop = end == std::string::npos ? p.size() : end;
+                for (size_t j = i + 2; j < stop; ) {
+                    size_t len = std::min(utf8_char_length(static_cast<unsigned char>(p[j])), stop - j);
+                    run.append(p, j, len);
+                    last_atom = len;
+                    j += len;
+                }
+                i = end == std::string::npos ? p.size() : end + 2;
+            } else if (e == 'E') {
+                i += 2;
+                continue;
+            } else if (!std::isalnum(static_cast<unsigned char>(e))) {
+                size_t len = utf8_char_length(static_cast<unsigned char>(e));
+                atom = p.substr(i + 1, len);
+                literal = true;
+                i += 1 + len;
+            } else if (e == 'n' || e == 't' || e == 'r' || e == 'f' || e == 'e' || e == 'a') {
+                static const std::map<char, char> simple = {
+                    {'n', '\n'}, {'t', '\t'}, {'r', '\r'}, {'f', '\f'}, {'e', '\x1b'}, {'a', '\a'}};
+                atom = std::string(1, simple.at(e));
+                literal = true;
+                i += 2;
+            } else if (e == 'x') {
+                uint32_t cp = 0;
+                size_t j = i + 2;
+                if (j < p.size() && p[j] == '{') {
+                    size_t end = p.find('}', j);
+                    if (end == std::string::npos || end == j + 1) return false;
+                    std::string hex = p.substr(j + 1, end - j - 1);
+                    if (hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) return false;
+                    cp = static_cast<uint32_t>(std::stoul(hex, nullptr, 16));
+                    j = end + 1;
+                } else {
+                    for (int k = 0; k < 2 && j < p.size() && std::isxdigit(static_cast<unsigned char>(p[j])); k++, j++)
+                        cp = cp * 16 + static_cast<uint32_t>(std::stoul(std::string(1, p[j]), nullptr, 16));
+                }
+                if (cp > 0x10FFFF) return false;
+                atom = string_utils::codepoint_to_utf8(cp);
+                literal = true;
+                i = j;
+            } else if (e == 'p' || e == 'P') {
+                size_t j = i + 2;
+                if (j < p.size() && p[j] == '{') {
+                    j = p.find('}', j);
+                    if (j == std::string::npos) return false;
+                }
+                end_run();
+                i = j + 1;
+            } else if (std::string("dDwWsShHvVRXNbBAzZGKC").find(e) != std::string::npos) {
+                // \N{...} names a character; not worth decoding
+                if (e == 'N' && i + 2 < p.size() && p[i + 2] == '{') return false;
+                end_run();
+                i += 2;
+            } else {
+                return false; // Back references, octal, \c, \g, \k, \o, ...
+            }
+        } else if (c == '.' || c == '^' || c == '$') {
+            end_run();
+            i++;
+        } else {
+            size_t len = utf8_char_length(static_cast<unsigned char>(c));
+            atom = p.substr(i, len);
+            literal = true;
+            i += len;
+        }
+
+        if (literal) {
+            run += atom;
+            last_atom = atom.size();
+        }
+    }
+    if (!run.empty()) runs.push_back(run);
+    if (runs.size() != 1) exact = false;
+    return true;
+}
+
+std::optional<std::string> required_literal(const std::string& pattern) {
+    std::vector<std::string> runs;
+    bool exact;
+    if (!parse_literal_runs(pattern, runs, exact)) return std::nullopt;
+    const std::string* best = nullptr;
+    for (const auto& run : runs) {
+        if (!best || run.size() > best->size()) best = &run;
+    }
+    if (!best) return std::nullopt;
+    return *best;
+}
+
+std::optional<std::string> exact_literal(const std::string& pattern) {
+    std::vector<std::string> runs;
+    bool exact;
+    if (!parse_literal_runs(pattern, runs, exact) || !exact) return std::nullopt;
+    return runs.front();
+}
+
+// Per-thread pool of match data blocks, so that scanning does not create one per call.
+// A block only ever grows: one too small for a pattern's groups is replaced.
+struct MatchDataPool {
+    std::vector<pcre2_match_data*> blocks;
+    MatchDataPool() = default;
+    ~MatchDataPool() {
+        for (auto* block : blocks) pcre2_match_data_free(block);
+    }
+    MatchDataPool(const MatchDataPool&) = delete;
+    MatchDataPool& operator=(const MatchDataPool&) = delete;
+};
+
+static MatchDataPool& thread_match_data_pool() {
+    thread_local MatchDataPool pool;
+    return pool;
+}
+
+static uint32_t capture_count(const CompiledPattern& cp) {
+    uint32_t count = 0;
+    pcre2_pattern_info(cp.code(), PCRE2_INFO_CAPTURECOUNT, &count);
+    return count;
+}
+
+// Take a block with room for every group of cp; give it back with release_match_data
+static pcre2_match_data* acquire_match_data(const CompiledPattern& cp) {
+    auto& blocks = thread_match_data_pool().blocks;
+    uint32_t pairs = capture_count(cp) + 1;
+    if (!blocks.empty()) {
+        pcre2_match_data* block = blocks.back();
+        blocks.pop_back();
+        if (pcre2_get_ovector_count(block) >= pairs) return block;
+        pcre2_match_data_free(block);
+    }
+    return pcre2_match_data_create(pairs, nullptr);
+}
+
+static void release_match_data(pcre2_match_data* block) {
+    thread_match_data_pool().blocks.push_back(block);
+}
+
+std::string_view MatchView::group(size_t index) const {
+    if (index >= count_ || ovector_[2 * index] == PCRE2_UNSET) return {};
+    return std::string_view(subject_->data() + base_ + ovector_[2 * index],
+                            ovector_[2 * index + 1] - ovector_[2 * index]);
+}
+
+size_t MatchView::group_start(size_t index) const {
+    if (index >= count_ || ovector_[2 * index] == PCRE2_UNSET) return std::string::npos;
+    return base_ + ovector_[2 * index];
+}
+
+int MatchView::group_number(const std::string& name) const {
+    const auto& named_groups = pattern_->named_groups();
+    auto it = named_groups.find(name);
+    return it == named_groups.end() ? -1 : it->second;
+}
+
+// Whether PCRE2 sees offset (> 0) as the start of a line: it follows a newline of the
+// pattern's newline convention
+static bool follows_newline(const CompiledPattern& cp, const std::string& subject, size_t offset) {
+    uint32_t newline = 0;
+    pcre2_pattern_info(cp.code(), PCRE2_INFO_NEWLINE, &newline);
+    char prev = subject[offset - 1];
+    switch (newline) {
+    case PCRE2_NEWLINE_LF: return prev == '\n';
+    case PCRE2_NEWLINE_CR: return prev == '\r';
+    case PCRE2_NEWLINE_CRLF: return prev == '\n' && offset >= 2 && subject[offset - 2] == '\r';
+    case PCRE2_NEWLINE_ANYCRLF: return prev == '\n' || prev == '\r';
+    case PCRE2_NEWLINE_ANY: return prev == '\n' || prev == '\r' || prev == '\x0b' || prev == '\x0c';
+    default: return false;
+    }
+}
 
-    m.start = ovector[0];
-    m.end = ovector[1];
-    m.str = subject.substr(m.start, m.end - m.start);
+// Where the subject PCRE2 is given for a range starting at range_start begins. Normally that
+// is the start of subject, so that lookbehinds see the text before the range. A range that
+// does not start after a PCRE2 newline (e.g. one of the other newlines in
+// globalvar::newlines) is passed as a subject of its own instead, so that ^ still matches
+// at its start.
+static size_t range_base(const CompiledPattern& cp, const std::string& subject, size_t range_start) {
+    return range_start > 0 && !follows_newline(cp, subject, range_start) ? range_start : 0;
+}
+
+MatchCursor::MatchCursor(const CompiledPattern& pattern, const std::string& subject,
+                         size_t range_start, size_t range_end, uint32_t match_options)
+    : pattern_(pattern), subject_(subject), range_start_(range_start),
+      base_(range_base(pattern, subject, range_start)),
+      end_(range_end), offset_(range_start), options_(match_options), match_data_(nullptr) {
+    pattern_.ensure_jit();
+    match_data_ = acquire_match_data(pattern_);
+    view_.pattern_ = &pattern_;
+    view_.subject_ = &subject_;
+    view_.base_ = base_;
+    view_.ovector_ = pcre2_get_ovector_pointer(match_data_);
+}
+
+MatchCursor::~MatchCursor() { release_match_data(match_data_); }
+
+void MatchCursor::seek(size_t offset) {
+    offset_ = std::max(offset, range_start_);
+    done_ = false;
+}
 
+bool MatchCursor::next() {
+    if (done_ || offset_ > end_) return false;
+    int rc = pcre2_match(pattern_.code(),
+                         reinterpret_cast<PCRE2_SPTR>(subject_.c_str() + base_),
+                         end_ - base_, offset_ - base_, options_, match_data_, thread_match_context());
+    if (rc < 0) {
+        done_ = true;
+        if (rc == PCRE2_ERROR_MATCHLIMIT || rc == PCRE2_ERROR_DEPTHLIMIT ||
+            rc == PCRE2_ERROR_HEAPLIMIT || rc == PCRE2_ERROR_JIT_STACKLIMIT) {
+            throw match_limit_error("Match limit exceeded", rc == PCRE2_ERROR_MATCHLIMIT);
+        }
+        return false;
+    }
+    view_.count_ = static_cast<uint32_t>(rc);
+    view_.start_ = base_ + view_.ovector_[0];
+    view_.end_ = base_ + view_.ovector_[1];
+
+    // Advance past match (handle zero-length matches)
+    offset_ = view_.end_ == view_.start_ ? view_.end_ + 1 : view_.end_;
+    return true;
+}
+
+// Copy a match out of the pooled match data
+static Match build_match(const CompiledPattern& cp, const MatchView& view) {
+    Match m;
+    m.start = view.start();
+    m.end = view.end();
+    m.str = std::string(view.str());
+
+    uint32_t count = capture_count(cp) + 1;
     for (uint32_t i = 0; i < count; i++) {
-        if (ovector[2 * i] == PCRE2_UNSET) {
+        size_t s = view.group_start(i);
+        if (s == std::string::npos) {
             m.groups.push_back("");
             m.group_offsets.push_back({std::string::npos, std::string::npos});
         } else {
-            size_t s = ovector[2 * i];
-            size_t e = ovector[2 * i + 1];
-            m.groups.push_back(subject.substr(s, e - s));
-            m.group_offsets.push_back({s, e});
+            std::string_view text = view.group(i);
+            m.groups.push_back(std::string(text));
+            m.group_offsets.push_back({s, s + text.size()});
         }
     }
 
-    m.named_groups = extract_named_groups(code);
+    m.named_groups = cp.named_groups();
     return m;
 }
 
+// Match loop shared by finditer and finditer_range.
+// PCRE2 sees subject[base, end_offset) as the whole subject; matching starts at start_offset.
+static std::vector<Match> find_all(const CompiledPattern& cp, const std::string& subject,
+                                   size_t base, size_t start_offset, size_t end_offset,
+                                   uint32_t match_options) {
+    std::vector<Match> results;
+    MatchCursor cursor(cp, subject, base, end_offset, match_options);
+    cursor.seek(start_offset);
+    while (cursor.next()) results.push_back(build_match(cp, cursor.match()));
+    return results;
+}
+
 std::vector<Match> finditer(const std::string& pattern, const std::string& subject,
                             size_t start_offset, size_t end_offset) {
+    return finditer(*get_pattern(pattern), subject, start_offset, end_offset);
+}
+
+std::vector<Match> finditer(const CompiledPattern& cp, const std::string& subject,
+                            size_t start_offset, size_t end_offset) {
     if (end_offset == std::string::npos) end_offset = subject.size();
+    return find_all(cp, subject, 0, start_offset, end_offset, 0);
+}
 
-    CompiledPattern cp(pattern);
-    pcre2_match_data* match_data = pcre2_match_data_create_from_pattern(cp.code, nullptr);
+std::vector<Match> finditer_range(const CompiledPattern& cp, const std::string& subject,
+                                  size_t range_start, size_t range_end, uint32_t match_options) {
+    return find_all(cp, subject, range_start, range_start, range_end, match_options);
+}
 
-    std::vector<Match> results;
+std::optional<size_t> partial_match_start(const CompiledPattern& cp, const std::string& subject,
+                                          size_t start_offset, uint32_t match_options) {
+    cp.ensure_jit();
+    pcre2_match_data* match_data = acquire_match_data(cp);
+    std::optional<size_t> result = std::string::npos;
+    // An incomplete character at the end is text still to come: leave it out
+    size_t length = subject.size();
+    size_t lead = length;
+    while (lead > 0 && length - lead < 3 && (static_cast<unsigned char>(subject[lead - 1]) & 0xc0) == 0x80) lead--;
+    if (lead > 0 && lead - 1 + utf8_char_length(static_cast<unsigned char>(subject[lead - 1])) > length) {
+        length = lead - 1;
+    }
     size_t offset = start_offset;
+    while (offset <= length) {
+        int rc = pcre2_match(cp.code(), reinterpret_cast<PCRE2_SPTR>(subject.c_str()), length,
+                             offset, match_options | PCRE2_PARTIAL_HARD, match_data, thread_match_context());
+        PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(match_data);
+        if (rc == PCRE2_ERROR_PARTIAL) {
+            result = ovector[0];
+            break;
+        }
+        if (rc == PCRE2_ERROR_NOMATCH) break;
+        if (rc < 0) {
+            result = std::nullopt;
+            break;
+        }
+        if (ovector[1] > ovector[0]) {
+            offset = ovector[1];
+        } else if (ovector[0] < length) {
+            // Past an empty match by one whole character
+            offset = ovector[0] + utf8_char_length(static_cast<unsigned char>(subject[ovector[0]]));
+        } else {
+            break;
+        }
+    }
+    release_match_data(match_data);
+    return result;
+}
 
-    while (offset <= end_offset) {
-        int rc = pcre2_match(cp.code,
-                             reinterpret_cast<PCRE2_SPTR>(subject.c_str()),
-                             end_offset, offset, 0, match_data, nullptr);
-        if (rc < 0) break;
+// Combined pattern sets
 
-        Match m = build_match(cp.code, match_data, subject);
+// Match limit for one combined scan; past it every pattern counts as a candidate
+static constexpr uint32_t pattern_set_match_limit = 1000000;
 
-        results.push_back(m);
+// Per-thread match context for pattern sets (has a callout, unlike thread_match_context)
+struct SetContext {
+    pcre2_jit_stack* stack;
+    pcre2_match_context* mcontext;
+    SetContext() {
+        stack = pcre2_jit_stack_create(32 * 1024, 4 * 1024 * 1024, nullptr);
+        mcontext = pcre2_match_context_create(nullptr);
+        if (stack && mcontext) pcre2_jit_stack_assign(mcontext, nullptr, stack);
+        if (mcontext) pcre2_set_match_limit(mcontext, pattern_set_match_limit);
+    }
+    ~SetContext() {
+        if (mcontext) pcre2_match_context_free(mcontext);
+        if (stack) pcre2_jit_stack_free(stack);
+    }
+    SetContext(const SetContext&) = delete;
+    SetContext& operator=(const SetContext&) = delete;
+};
 
-        // Advance past match (handle zero-length matches)
-        if (m.end == m.start) {
-            offset = m.end + 1;
-            if (offset > end_offset) break;
-        } else {
-            offset = m.end;
+// Record the branch that reached its end, then fail so that every other branch
+// and start position is tried as well
+static int pattern_set_callout(pcre2_callout_block* block, void* data) {
+    auto* found = static_cast<std::vector<bool>*>(data);
+    if (block->mark != nullptr) {
+        size_t index = std::strtoul(reinterpret_cast<const char*>(block->mark), nullptr, 10);
+        if (index < found->size()) (*found)[index] = true;
+    }
+    return 1;
+}
+
+bool PatternSet::combinable(const std::string& pattern) {
+    // Group numbers and names change in the alternation; verbs, callouts and \K would act
+    // on the whole alternation; \Q or extended mode could swallow the closing parenthesis
+    static const char* const unsupported[] = {
+        "(*", "(?C", "(?R", "(?&", "(?P", "(?(", "(?<", "(?'", "(?|", "\\g", "\\k", "\\K", "\\Q"};
+    for (const char* item : unsupported) {
+        if (pattern.find(item) != std::string::npos) {
+            // Lookbehind assertions are fine
+            if (std::strcmp(item, "(?<") == 0) {
+                bool only_lookbehind = true;
+                for (size_t pos = pattern.find(item); pos != std::string::npos; pos = pattern.find(item, pos + 1)) {
+                    if (pos + 3 >= pattern.size() || (pattern[pos + 3] != '=' && pattern[pos + 3] != '!'))
+                        only_lookbehind = false;
+                }
+                if (only_lookbehind) continue;
+            }
+            return false;
+        }
+    }
+    for (size_t pos = pattern.find("(?"); pos != std::string::npos; pos = pattern.find("(?", pos + 1)) {
+        if (pos + 2 < pattern.size() && (std::isdigit(static_cast<unsigned char>(pattern[pos + 2])) ||
+                                         pattern[pos + 2] == '+' || pattern[pos + 2] == '-') &&
+            option_letters_end(pattern, pos) == std::string::npos) {
+            return false; // (?1), (?+1), (?-1) subroutine calls
         }
+        size_t end = option_letters_end(pattern, pos);
+        if (end != std::string::npos && pattern.substr(pos + 2, end - pos - 2).find('x') != std::string::npos)
+            return false;
+    }
+    // Back references
+    for (size_t pos = pattern.find('\\'); pos != std::string::npos; pos = pattern.find('\\', pos + 2)) {
+        if (pos + 1 < pattern.size() && pattern[pos + 1] >= '1' && pattern[pos + 1] <= '9') return false;
     }
+    return true;
+}
 
-    pcre2_match_data_free(match_data);
-    return results;
+PatternSet::PatternSet(const std::vector<std::string>& patterns) : size_(patterns.size()) {
+    std::string combined = "(?:";
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (i > 0) combined += "|";
+        combined += "(?:" + patterns[i] + ")(*MARK:" + std::to_string(i) + ")(?C1)";
+    }
+    combined += ")";
+    combined_ = std::make_unique<CompiledPattern>(combined, 0, true);
+}
+
+bool PatternSet::find_matching(const std::string& subject, size_t range_start, size_t range_end,
+                               std::vector<bool>& found) const {
+    thread_local SetContext ctx;
+    found.assign(size_, false);
+    combined_->ensure_jit();
+    pcre2_set_callout(ctx.mcontext, pattern_set_callout, &found);
+    pcre2_match_data* match_data = acquire_match_data(*combined_);
+    // The same subject MatchCursor matches the range in
+    size_t base = range_base(*combined_, subject, range_start);
+    int rc = pcre2_match(combined_->code(),
+                         reinterpret_cast<PCRE2_SPTR>(subject.c_str() + base),
+                         range_end - base, range_start - base, 0, match_data, ctx.mcontext);
+    release_match_data(match_data);
+    // Invalid UTF-8 also fails every single pattern; only resource limits leave the result incomplete
+    return rc == PCRE2_ERROR_NOMATCH || (rc <= PCRE2_ERROR_UTF8_ERR1 && rc >= PCRE2_ERROR_UTF8_ERR21);
 }
 
 // Expand Python-style replacement: \g<name>, \g<1>, \1, \\, etc.
-std::string expand_replacement(const std::string& replacement, const Match& match) {
-    std::string result;
+// group(idx) gives the text of a group (empty if unset or out of range), number(name) its index.
+template <typename GroupText, typename GroupNumber>
+static void expand_into(const std::string& replacement, std::string& result,
+                        GroupText group, GroupNumber number) {
     size_t i = 0;
     while (i < replacement.size()) {
         if (replacement[i] == '\\' && i + 1 < replacement.size()) {
@@ -141,19 +751,10 @@ std::string expand_replacement(const std::string& replacement, const Match& matc
                     for (char c : ref) { if (!std::isdigit(c)) { is_number = false; break; } }
 
                     if (is_number) {
-                        int idx = std::stoi(ref);
-                        if (idx >= 0 && idx < static_cast<int>(match.groups.size())) {
-                            result += match.groups[idx];
-                        }
+                        result += group(std::stoi(ref));
                     } else {
-                        // Named group - look up via named_groups map
-                        auto it = match.named_groups.find(ref);
-                        if (it != match.named_groups.end()) {
-                            int idx = it->second;
-                            if (idx >= 0 && idx < static_cast<int>(match.groups.size())) {
-                                result += match.groups[idx];
-                            }
-                        }
+                        // Named group
+                        result += group(number(ref));
                     }
                     i = close + 1;
                     continue;
@@ -172,10 +773,7 @@ std::string expand_replacement(const std::string& replacement, const Match& matc
                 continue;
             } else if (std::isdigit(next)) {
                 // \1, \2, etc.
-                int idx = next - '0';
-                if (idx >= 0 && idx < static_cast<int>(match.groups.size())) {
-                    result += match.groups[idx];
-                }
+                result += group(next - '0');
                 i += 2;
                 continue;
             }
@@ -183,9 +781,28 @@ std::string expand_replacement(const std::string& replacement, const Match& matc
         result += replacement[i];
         i++;
     }
+}
+
+std::string expand_replacement(const std::string& replacement, const Match& match) {
+    std::string result;
+    expand_into(replacement, result,
+        [&](int idx) {
+            return idx >= 0 && idx < static_cast<int>(match.groups.size())
+                ? std::string_view(match.groups[idx]) : std::string_view();
+        },
+        [&](const std::string& name) {
+            auto it = match.named_groups.find(name);
+            return it == match.named_groups.end() ? -1 : it->second;
+        });
     return result;
 }
 
+void expand_replacement(const std::string& replacement, const MatchView& match, std::string& result) {
+    expand_into(replacement, result,
+        [&](int idx) { return idx >= 0 ? match.group(idx) : std::string_view(); },
+        [&](const std::string& name) { return match.group_number(name); });
+}
+
 // Perform all the finditer + expand in one go, building the result string
 std::string sub(const std::string& pattern, const std::string& replacement,
                 const std::string& subject) {
@@ -2,8 +2,12 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory>
+#include <optional>
+#include <mutex>
 #include <stdexcept>
 
 namespace clitheme {
@@ -15,12 +19,75 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+// Thrown when a match gives up on a resource limit (see set_match_limits)
+class match_limit_error : public regex_error {
+public:
+    // match_limit: the match limit (a measure of time) was hit, not the heap, depth or JIT stack limit
+    match_limit_error(const std::string& what, bool match_limit) : regex_error(what), match_limit_(match_limit) {}
+    bool is_match_limit() const { return match_limit_; }
+
+private:
+    bool match_limit_;
+};
+
+// RAII wrapper for pcre2_code
+// Patterns are always compiled with PCRE2_UTF | PCRE2_MULTILINE on top of the given options.
+class CompiledPattern {
+public:
+    // Throws regex_error on failure. With use_jit, pcre2_jit_compile is run on first
+    // use (falls back to the interpreter if JIT is unavailable).
+    CompiledPattern(const std::string& pattern, uint32_t options = 0, bool use_jit = false);
+    // Take ownership of already compiled code (e.g. from pcre2_serialize_decode)
+    explicit CompiledPattern(pcre2_code* code, bool use_jit = false);
+    ~CompiledPattern();
+    CompiledPattern(const CompiledPattern&) = delete;
+    CompiledPattern& operator=(const CompiledPattern&) = delete;
+
+    pcre2_code* code() const { return code_; }
+    // JIT compile now if requested and not done yet; thread-safe
+    void ensure_jit() const;
+    bool is_jit() const { return jit_; }
+    // name -> group index, extracted once at compile time
+    const std::map<std::string, int>& named_groups() const { return named_groups_; }
+
+private:
+    pcre2_code* code_;
+    bool use_jit_;
+    mutable bool jit_;
+    mutable std::once_flag jit_once_;
+    std::map<std::string, int> named_groups_;
+};
+
+using PatternHandle = std::shared_ptr<const CompiledPattern>;
+
+// Get a compiled (and JIT compiled) pattern from the process-wide cache,
+// keyed by pattern text and options. Compiles on first use; throws regex_error on failure.
+PatternHandle get_pattern(const std::string& pattern, uint32_t options = 0);
+
+// Look up a cached pattern without compiling it; null if not cached
+PatternHandle find_pattern(const std::string& pattern, uint32_t options = 0);
+
+// Add an already compiled pattern to the cache (e.g. loaded from the on-disk cache)
+void add_pattern(const std::string& pattern, uint32_t options, PatternHandle compiled);
+
+// Drop all cached patterns
+void clear_pattern_cache();
+
 // Try compiling a pattern; throws regex_error on failure
 void validate_pattern(const std::string& pattern);
 
 // Test if a substitution is valid (compile pattern and try sub on empty string)
 void validate_substitution(const std::string& pattern, const std::string& replacement);
 
+// Longest literal that every match of pattern must contain (as UTF-8 bytes);
+// none if the pattern has top-level alternatives, caseless or extended mode
+// or constructs the extractor does not understand.
+std::optional<std::string> required_literal(const std::string& pattern);
+
+// The string pattern matches if it is nothing but literal characters
+// (e.g. an escaped plain string); none otherwise or if it is empty.
+std::optional<std::string> exact_literal(const std::string& pattern);
+
 // A single match result
 struct Match {
     size_t start;  // byte offset in subject
@@ -33,13 +100,123 @@ struct Match {
     std::map<std::string, int> named_groups; // name -> group index
 };
 
+// Limits for the matches finditer/finditer_range run on the calling thread:
+// pcre2_set_match_limit and pcre2_set_heap_limit (KiB). Running into one throws match_limit_error.
+void set_match_limits(uint32_t match_limit, uint32_t heap_limit_kib);
+// Back to PCRE2's defaults
+void reset_match_limits();
+
 // Find all non-overlapping matches of pattern in subject within [start_offset, end_offset)
 // Supports PCRE2_MULTILINE flag.
 std::vector<Match> finditer(const std::string& pattern, const std::string& subject,
                             size_t start_offset = 0, size_t end_offset = std::string::npos);
 
+// Same as above, using a precompiled pattern
+std::vector<Match> finditer(const CompiledPattern& pattern, const std::string& subject,
+                            size_t start_offset = 0, size_t end_offset = std::string::npos);
+
+// Find all non-overlapping matches within subject[range_start, range_end) without copying it.
+// Matching starts at range_start and sees range_end as the end of the subject: $ and \z
+// match there unless PCRE2_NOTEOL is passed in match_options. Lookbehinds see the text before
+// range_start. ^ matches at range_start if it is 0 (unless PCRE2_NOTBOL is passed) or follows
+// a newline; a range after any other line separator is matched as a subject of its own.
+// Offsets in the results are relative to the whole subject.
+std::vector<Match> finditer_range(const CompiledPattern& pattern, const std::string& subject,
+                                  size_t range_start, size_t range_end, uint32_t match_options = 0);
+
+// A match seen through MatchCursor: offsets into the subject and the ovector of a pooled
+// match data block. Nothing is copied; it is only valid until the cursor moves on.
+class MatchView {
+public:
+    size_t start() const { return start_; }
+    size_t end() const { return end_; }
+    std::string_view str() const { return group(0); }
+    // Text of group index; empty if the group is unset or does not exist
+    std::string_view group(size_t index) const;
+    // Offset of group index in the subject; npos if the group is unset
+    size_t group_start(size_t index) const;
+    // Index of a named group; -1 if the pattern has no group of that name
+    int group_number(const std::string& name) const;
+
+private:
+    friend class MatchCursor;
+    const CompiledPattern* pattern_ = nullptr;
+    const std::string* subject_ = nullptr;
+    size_t base_ = 0;
+    const PCRE2_SIZE* ovector_ = nullptr;
+    uint32_t count_ = 0;  // groups set by the match
+    size_t start_ = 0;
+    size_t end_ = 0;
+};
+
+// Walks the matches finditer_range would return, one at a time, without building Match
+// objects. The match data comes from a per-thread pool and goes back to it when the
+// cursor is destroyed, so a scan allocates nothing once the pool is warm.
+//   MatchCursor cursor(pattern, subject, range_start, range_end);
+//   while (cursor.next()) use(cursor.match());
+class MatchCursor {
+public:
+    MatchCursor(const CompiledPattern& pattern, const std::string& subject,
+                size_t range_start, size_t range_end, uint32_t match_options = 0);
+    ~MatchCursor();
+    MatchCursor(const MatchCursor&) = delete;
+    MatchCursor& operator=(const MatchCursor&) = delete;
+
+    // Move to the next match; false when there are no more. Throws match_limit_error.
+    bool next();
+    // Look for the next match from offset on (not before range_start); the text before
+    // it stays visible to lookbehinds
+    void seek(size_t offset);
+    const MatchView& match() const { return view_; }
+
+private:
+    const CompiledPattern& pattern_;
+    const std::string& subject_;
+    size_t range_start_;
+    size_t base_;  // where the subject PCRE2 sees starts
+    size_t end_;
+    size_t offset_;
+    uint32_t options_;
+    pcre2_match_data* match_data_;
+    MatchView view_;
+    bool done_ = false;
+};
+
+// Where the leftmost partial match (PCRE2_PARTIAL_HARD) of pattern in subject starts, looking
+// from start_offset on: a match that more text after the end of subject could complete
+// (an incomplete UTF-8 character at the end counts as such text). Complete matches are skipped. npos if there is none; none if it could not be decided
+// (a resource limit, or invalid UTF-8 in subject).
+std::optional<size_t> partial_match_start(const CompiledPattern& pattern, const std::string& subject, size_t start_offset = 0,
+                           uint32_t match_options = 0);
+
+// Several patterns matched as one alternation, to find out in a single pass which of them
+// match a range. Each branch is tagged with (*MARK:<index>) and ends in a callout that
+// records the mark and fails, so every branch is tried at every position.
+class PatternSet {
+public:
+    // Patterns must be combinable(); throws regex_error if the alternation does not compile
+    explicit PatternSet(const std::vector<std::string>& patterns);
+
+    size_t size() const { return size_; }
+    // Set found[i] for every pattern i that finditer_range would find a match for in
+    // subject[range_start, range_end). Returns false if a resource limit was hit; found
+    // is incomplete then.
+    bool find_matching(const std::string& subject, size_t range_start, size_t range_end,
+                       std::vector<bool>& found) const;
+
+    // Whether pattern keeps its meaning inside the alternation (no back references, named
+    // groups, subroutine calls, verbs, callouts, \K, \Q or extended mode)
+    static bool combinable(const std::string& pattern);
+
+private:
+    std::unique_ptr<CompiledPattern> combined_;
+    size_t size_;
+};
+
 // Expand a Python-style replacement string (\g<name>, \g<1>, \1, etc.) using match data
 std::string expand_replacement(const std::string& replacement, const Match& match);
+// Same for a match from MatchCursor, appending to result (which keeps its capacity across calls)
+void expand_replacement(const std::string& replacement, const MatchView& match, std::string& result);
 
 // Perform regex substitution: replace first match of pattern in subject
 // replacement uses Python syntax: \g<name>, \g<1>, \1, etc.
@@ -0,0 +1,102 @@
+#include "rule_set.hpp"
+#include "pattern_cache.hpp"
+
+namespace clitheme {
+
+RuleSet::RuleSet(const std::optional<std::string>& command, bool is_stderr, bool combine_regex)
+    : command_(command), is_stderr_(is_stderr) {
+    // fetch_substrules already applies the locale fallback and check_command
+    for (auto& rule : db_interface::fetch_substrules(command)) {
+        if (rule.stdout_stderr_only != 0 && static_cast<int>(is_stderr) + 1 != rule.stdout_stderr_only) continue;
+        rules_.push_back(std::move(rule));
+    }
+    slow_.reset(new std::atomic<bool>[rules_.size()]());
+
+    if (rules_.empty()) return;
+
+    // Compile every match pattern up front; identical patterns share one compiled copy.
+    // Patterns already in the on-disk cache are decoded instead of compiled.
+    std::string db_path = db_interface::get_db_path();
+    pattern_cache::load(db_path);
+    std::vector<pattern_cache::PatternKey> compiled_keys;
+    patterns_.reserve(rules_.size());
+    for (const auto& rule : rules_) {
+        try {
+            patterns_.push_back(pcre2_regex::get_pattern(rule.match_pattern));
+            compiled_keys.emplace_back(rule.match_pattern, 0);
+        } catch (const pcre2_regex::regex_error&) {
+            patterns_.push_back(nullptr);
+        }
+    }
+    pattern_cache::save(db_path, compiled_keys);
+
+    // Plain-string rules, grouped by consecutive file_id (ignoreescapes rules match
+    // other text, so they are never grouped)
+    plain_groups_.assign(rules_.size(), std::string::npos);
+    plain_literal_ids_.assign(rules_.size(), std::string::npos);
+    size_t file_run = 0, group_file_run = std::string::npos;
+    for (size_t i = 0; i < rules_.size(); i++) {
+        const auto& rule = rules_[i];
+        if (i > 0 && rules_[i - 1].file_id != rule.file_id) file_run++;
+        if (rule.is_regex || rule.match_is_multiline || rule.ignore_escapes || !patterns_[i]) continue;
+        auto literal = pcre2_regex::exact_literal(rule.match_pattern);
+        if (!literal.has_value()) continue;
+        if (group_file_run != file_run) {
+            plain_literals_.emplace_back();
+            group_file_run = file_run;
+        }
+        plain_groups_[i] = plain_literals_.size() - 1;
+        plain_literal_ids_[i] = plain_literals_.back().add(*literal);
+    }
+    for (auto& group : plain_literals_) group.build();
+
+    // Other single-line rules of a file combined into one PatternSet
+    regex_groups_.assign(rules_.size(), std::string::npos);
+    regex_members_.assign(rules_.size(), std::string::npos);
+    if (combine_regex) {
+        std::vector<size_t> members;
+        auto flush = [&]() {
+            // A set only pays off with several rules; if it does not compile, rules stay separate
+            if (members.size() >= 2) {
+                std::vector<std::string> member_patterns;
+                for (size_t index : members) member_patterns.push_back(rules_[index].match_pattern);
+                try {
+                    regex_patterns_.push_back(std::make_unique<pcre2_regex::PatternSet>(member_patterns));
+                    for (size_t m = 0; m < members.size(); m++) {
+                        regex_groups_[members[m]] = regex_patterns_.size() - 1;
+                        regex_members_[members[m]] = m;
+                    }
+                } catch (const pcre2_regex::regex_error&) {}
+            }
+            members.clear();
+        };
+        for (size_t i = 0; i < rules_.size(); i++) {
+            if (i > 0 && rules_[i - 1].file_id != rules_[i].file_id) flush();
+            if (rules_[i].match_is_multiline || rules_[i].ignore_escapes || !patterns_[i] ||
+                plain_groups_[i] != std::string::npos) continue;
+            if (!pcre2_regex::PatternSet::combinable(rules_[i].match_pattern)) continue;
+            members.push_back(i);
+        }
+        flush();
+    }
+
+    // Required literals were extracted by the generator (plain-string rules have their own scan)
+    literal_ids_.reserve(rules_.size());
+    for (size_t i = 0; i < rules_.size(); i++) {
+        const auto& literal = rules_[i].required_literal;
+        bool usable = patterns_[i] && plain_groups_[i] == std::string::npos &&
+                      literal.has_value() && !literal->empty();
+        literal_ids_.push_back(usable ? literals_.add(*literal) : std::string::npos);
+    }
+    literals_.build();
+}
+
+std::vector<size_t> RuleSet::slow_rules() const {
+    std::vector<size_t> result;
+    for (size_t i = 0; i < rules_.size(); i++) {
+        if (is_slow(i)) result.push_back(i);
+    }
+    return result;
+}
+
+} // namespace clitheme
@@ -0,0 +1,69 @@
+#pragma once
+#include "db_interface.hpp"
+#include "pcre2_regex.hpp"
+#include "aho_corasick.hpp"
+#include <string>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <atomic>
+
+namespace clitheme {
+
+// Substitution rules for one exec session.
+// Fetched from the database once and pre-filtered for the command,
+// the current locale and the output stream, so that match_content
+// does not have to touch the database for every output chunk.
+class RuleSet {
+public:
+    // With combine_regex, the single-line regex rules of each file are also scanned
+    // together as one PatternSet before running them one by one (see regex_group)
+    explicit RuleSet(const std::optional<std::string>& command = std::nullopt, bool is_stderr = false,
+                     bool combine_regex = false);
+
+    const std::vector<db_interface::Item>& rules() const { return rules_; }
+    // Compiled match pattern of rules()[index]; null if the pattern failed to compile
+    const pcre2_regex::PatternHandle& pattern(size_t index) const { return patterns_[index]; }
+    // Required literals of the rules, for finding all of them in one scan of a chunk
+    const AhoCorasick& literals() const { return literals_; }
+    // Id in literals() of the literal every match of rules()[index] contains; npos if none
+    size_t literal_id(size_t index) const { return literal_ids_[index]; }
+    // Plain-string rules ([subst_string], single line) are matched with one automaton
+    // per run of rules from the same file instead of one regex each.
+    // Group of rules()[index] and its literal's id in plain_literals(group); npos if not plain.
+    size_t plain_group(size_t index) const { return plain_groups_[index]; }
+    size_t plain_literal_id(size_t index) const { return plain_literal_ids_[index]; }
+    const AhoCorasick& plain_literals(size_t group) const { return plain_literals_[group]; }
+    size_t plain_group_count() const { return plain_literals_.size(); }
+    // Combined regex rules of a file: group of rules()[index] and its index in
+    // regex_patterns(group); npos if the rule is matched on its own only
+    size_t regex_group(size_t index) const { return regex_groups_[index]; }
+    size_t regex_member(size_t index) const { return regex_members_[index]; }
+    const pcre2_regex::PatternSet& regex_patterns(size_t group) const { return *regex_patterns_[group]; }
+    // Rules that ran out of the substitution time budget; match_content skips them from then on
+    bool is_slow(size_t index) const { return slow_[index].load(std::memory_order_relaxed); }
+    void mark_slow(size_t index) const { slow_[index].store(true, std::memory_order_relaxed); }
+    std::vector<size_t> slow_rules() const;
+    bool empty() const { return rules_.empty(); }
+    size_t size() const { return rules_.size(); }
+
+    const std::optional<std::string>& command() const { return command_; }
+    bool is_stderr() const { return is_stderr_; }
+
+private:
+    std::vector<db_interface::Item> rules_;
+    std::vector<pcre2_regex::PatternHandle> patterns_;
+    AhoCorasick literals_;
+    std::vector<size_t> literal_ids_;
+    std::vector<AhoCorasick> plain_literals_;
+    std::vector<size_t> plain_groups_;
+    std::vector<size_t> plain_literal_ids_;
+    std::vector<std::unique_ptr<pcre2_regex::PatternSet>> regex_patterns_;
+    std::vector<size_t> regex_groups_;
+    std::vector<size_t> regex_members_;
+    std::optional<std::string> command_;
+    bool is_stderr_;
+    std::unique_ptr<std::atomic<bool>[]> slow_;
+};
+
+} // namespace clitheme
@@ -0,0 +1,110 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <utility>
+#include <cstddef>
+
+namespace clitheme {
+
+// Bounded single-producer/single-consumer queue.
+// try_push/try_pop are lock-free; push/pop spin briefly and then sleep until the
+// other side makes progress. The mutex is only taken to park or wake a thread.
+template <typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side
+    bool try_push(T& item) {
+        if (!push_slot(item)) return false;
+        wake();
+        return true;
+    }
+    // Wait while full; returns false (dropping item) if the queue was closed
+    bool push(T item) {
+        bool pushed = false;
+        wait_for([&]() { return (pushed = push_slot(item)) || closed_.load(); });
+        if (pushed) wake();
+        return pushed;
+    }
+    // No more items will be pushed; wakes a waiting consumer
+    void close() {
+        closed_.store(true);
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+    // Consumer side
+    bool try_pop(T& item) {
+        if (!pop_slot(item)) return false;
+        wake();
+        return true;
+    }
+    // Wait for an item; returns false once the queue is closed and empty
+    bool pop(T& item) {
+        bool popped = false;
+        wait_for([&]() { return (popped = pop_slot(item)) || closed_.load(); });
+        // Items pushed before close() are still delivered
+        if (!popped) popped = pop_slot(item);
+        if (popped) wake();
+        return popped;
+    }
+
+private:
+    bool push_slot(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) return false;
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_seq_cst);
+        return true;
+    }
+    bool pop_slot(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        item = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    // Retry ready() until it returns true: spin, then yield, then sleep
+    template <typename Ready>
+    void wait_for(Ready&& ready) {
+        for (int i = 0; i < 64; i++) {
+            if (ready()) return;
+            if (i >= 16) std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiters_.fetch_add(1);
+        // The other side checks waiters_ after publishing, so no wakeup is missed
+        cv_.wait(lock, ready);
+        waiters_.fetch_sub(1);
+    }
+    void wake() {
+        if (waiters_.load() == 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+    std::vector<T> slots_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0}; // Next slot to pop
+    alignas(64) std::atomic<size_t> tail_{0}; // Next slot to push
+    alignas(64) std::atomic<bool> closed_{false};
+    std::atomic<int> waiters_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+} // namespace clitheme
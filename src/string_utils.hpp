@@ -126,6 +126,32 @@ inline std::string codepoint_to_utf8(uint32_t cp) {
     return result;
 }
 
+// Check for well-formed UTF-8 (no overlong forms, surrogates or code points past U+10FFFF),
+// the same rules PCRE2 applies to UTF subjects
+inline bool is_valid_utf8(const char* data, size_t length) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+    size_t i = 0;
+    while (i < length) {
+        unsigned char c = s[i];
+        if (c < 0x80) { i++; continue; }
+        size_t extra;
+        uint32_t cp;
+        if (c >= 0xC2 && c <= 0xDF) { extra = 1; cp = c & 0x1F; }
+        else if (c >= 0xE0 && c <= 0xEF) { extra = 2; cp = c & 0x0F; }
+        else if (c >= 0xF0 && c <= 0xF4) { extra = 3; cp = c & 0x07; }
+        else return false;
+        if (length - i <= extra) return false;
+        for (size_t k = 1; k <= extra; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) return false;
+            cp = (cp << 6) | (s[i + k] & 0x3F);
+        }
+        if ((extra == 2 && cp < 0x800) || (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF))) return false;
+        if (cp >= 0xD800 && cp <= 0xDFFF) return false;
+        i += extra + 1;
+    }
+    return true;
+}
+
 // Replace all occurrences of 'from' with 'to' in 'str'
 inline std::string replace_all(const std::string& str, const std::string& from, const std::string& to) {
     if (from.empty()) return str;
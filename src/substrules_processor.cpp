@@ -1,195 +1,372 @@
 #include "substrules_processor.hpp"
 #include "db_interface.hpp"
+#include "rule_set.hpp"
 #include "globalvar.hpp"
 #include "string_utils.hpp"
 #include "pcre2_regex.hpp"
-#include <regex>
+#include "line_index.hpp"
+#include "edit_list.hpp"
+#include "condition_map.hpp"
+#include "aho_corasick.hpp"
+#include "visible_text.hpp"
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <optional>
 #include <set>
 #include <cassert>
+#include <ctime>
 
 namespace clitheme {
 namespace substrules_processor {
 
+// CPU time used by the calling thread, in seconds
+static double thread_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+// Add the replacement of a match in the visible text as edits of its raw ranges, so that
+// the escape sequences inside the match stay. A replacement as long as the match is spread
+// over the ranges byte for byte (colors stay on the same characters) unless that would
+// split a UTF-8 character; otherwise all of it goes into the first range.
+static void add_visible_edits(EditList& edits, const std::vector<VisibleText::Range>& ranges,
+                              std::string replacement) {
+    if (ranges.size() == 1) {
+        edits.add(ranges[0].offset, ranges[0].length, std::move(replacement));
+        return;
+    }
+    size_t match_length = 0;
+    bool spread = true;
+    for (const auto& range : ranges) {
+        match_length += range.length;
+        if (match_length < replacement.size() && (static_cast<unsigned char>(replacement[match_length]) & 0xc0) == 0x80) {
+            spread = false;
+        }
+    }
+    spread = spread && match_length == replacement.size();
+    size_t used = 0;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        std::string part;
+        if (spread) {
+            part = replacement.substr(used, ranges[i].length);
+            used += ranges[i].length;
+        } else if (i == 0) {
+            part = std::move(replacement);
+        }
+        edits.add(ranges[i].offset, ranges[i].length, std::move(part));
+    }
+}
+
 std::pair<std::string, std::set<int>> match_content(
-    const std::string& content,
-    const std::optional<std::string>& command,
-    bool is_stderr
+    std::string content,
+    const RuleSet& rules,
+    bool child_in_foreground,
+    bool continues_line
 ) {
     assert(!content.empty() && "Empty content string");
 
-    std::string content_str = content;
-    auto substrules = db_interface::fetch_substrules(command);
+    // Only replaced (never copied) when a rule substitutes something
+    std::string content_str = std::move(content);
+    // The unprocessed content, kept once the first substitution replaces content_str
+    std::string original;
+    bool substituted = false;
+    // Line boundaries of content_str, shared by all rules; rebuilt only when a rule changes the content
+    LineIndex lines(content_str);
 
     std::set<std::string> encountered_ids;
-    std::string line_match_pattern = globalvar::build_line_match_pattern();
 
     std::set<std::string> encountered_files;
     std::string last_file_id;
-    // condition_map: 0x00=not matched, 0x01=matched, 0x02=end match here
-    std::vector<uint8_t> condition_map;
+    // Ranges of content_str produced by substitutions (matched / end match here)
+    ConditionMap condition_map;
+    // Which required literals occur in content_str; rescanned after a rule changes the content
+    std::vector<bool> present_literals;
+    bool literals_scanned = false;
+    // Start offsets of each plain-string literal of plain_group in content_str
+    std::vector<std::vector<size_t>> plain_occurrences;
+    size_t plain_group = std::string::npos;
+    // Lines of content_str where each rule of regex_group may match
+    std::vector<std::vector<size_t>> candidate_lines;
+    size_t regex_group = std::string::npos;
+    // Per line of content_str: 0 = not checked yet, 1 = valid UTF-8, 2 = invalid
+    std::vector<char> line_utf8(lines.size(), 0);
+    // content_str without escape sequences, for ignoreescapes rules; built on first use
+    std::optional<VisibleText> visible;
+    std::optional<LineIndex> visible_lines;
+    std::vector<bool> present_visible_literals;
+    bool visible_literals_scanned = false;
 
-    auto init_condition_map = [&]() {
-        condition_map.assign(content_str.size(), 0x00);
+    // A match is skipped if an endmatchhere substitution is in its lines, including the
+    // newline after it (a match right after any newline byte, even the \r of \r\n, starts its own line)
+    auto blocked_by_end_match = [&](size_t abs_start, size_t abs_end) {
+        size_t line_start = abs_start;
+        if (abs_start > 0 && !LineIndex::is_newline_byte(content_str[abs_start - 1])) {
+            line_start = lines.line_start(lines.line_of(abs_start - 1));
+        }
+        size_t line_end = abs_end < content_str.size() ? lines.line_end(lines.line_of(abs_end))
+                                                        : content_str.size();
+        return condition_map.has_end_match(line_start, line_end);
     };
-    init_condition_map();
 
-    for (const auto& rule : substrules) {
-        // Condition checking
-        if (encountered_ids.count(rule.unique_id)) continue;
-        if (rule.stdout_stderr_only != 0 && static_cast<int>(is_stderr) + 1 != rule.stdout_stderr_only) continue;
-        if (command.has_value() && rule.effective_command.has_value()) {
-            if (!db_interface::check_command(*rule.effective_command, rule.command_match_strictness,
-                                             *command, rule.command_is_regex)) continue;
+    // Time budget of this chunk: checked between rules and lines, and turned
+    // into PCRE2 limits so that a single match cannot run far past it
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(globalvar::output_subst_timeout));
+    // The chunk went over budget in rule_index: pass it through unprocessed. The rule is only
+    // blamed (skipped from then on) if it used the time itself, not if the thread was stopped
+    // or starved meanwhile, or if blame is set (a resource limit that does not depend on time).
+    auto time_out = [&](size_t rule_index, double rule_cpu_start,
+                        bool blame = false) -> std::pair<std::string, std::set<int>> {
+        if (blame || thread_cpu_seconds() - rule_cpu_start >= globalvar::output_subst_slow_rule_cpu_time) {
+            rules.mark_slow(rule_index);
         }
-        // Skip foreground_only check (no PID info in filter mode)
+        pcre2_regex::reset_match_limits();
+        return {substituted ? std::move(original) : std::move(content_str), {}};
+    };
+
+    for (size_t rule_index = 0; rule_index < rules.size(); rule_index++) {
+        const auto& rule = rules.rules()[rule_index];
+        const auto& pattern = rules.pattern(rule_index);
+        // Condition checking (command and stream are already filtered by RuleSet)
+        if (encountered_ids.count(rule.unique_id)) continue;
+        if (rules.is_slow(rule_index)) continue;
+        if (rule.foreground_only && !child_in_foreground) continue;
 
         // Reset condition map for new files
         if (rule.file_id != last_file_id) {
             encountered_files.insert(rule.file_id);
             last_file_id = rule.file_id;
-            init_condition_map();
+            condition_map.clear();
         }
+        if (!pattern) continue; // Skip invalid patterns
 
-        // Determine line lengths
-        std::vector<size_t> line_lengths;
-        if (rule.match_is_multiline) {
-            line_lengths.push_back(content_str.size());
-        } else {
-            // Split by line match pattern
-            std::regex lm_re(line_match_pattern);
-            auto it = std::sregex_iterator(content_str.begin(), content_str.end(), lm_re);
-            auto end = std::sregex_iterator();
-            for (; it != end; ++it) {
-                size_t len = it->length();
-                if (len > 0) line_lengths.push_back(len);
+        // ignoreescapes rules match the visible text, unless the content has no escapes
+        bool match_visible = false;
+        if (rule.ignore_escapes) {
+            if (!visible) visible.emplace(content_str);
+            match_visible = visible->has_escapes();
+            if (match_visible && !visible_lines) visible_lines.emplace(visible->text());
+        }
+
+        // Skip rules that cannot match: their required literal is not in the content
+        size_t literal_id = rules.literal_id(rule_index);
+        if (literal_id != std::string::npos && match_visible) {
+            if (!visible_literals_scanned) {
+                present_visible_literals = rules.literals().find_present(visible->text());
+                visible_literals_scanned = true;
+            }
+            if (!present_visible_literals[literal_id]) continue;
+        } else if (literal_id != std::string::npos) {
+            if (!literals_scanned) {
+                present_literals = rules.literals().find_present(content_str);
+                literals_scanned = true;
             }
-            if (line_lengths.empty()) line_lengths.push_back(content_str.size());
+            if (!present_literals[literal_id]) continue;
         }
 
-        auto new_condition_map = condition_map;
-        int new_condition_map_offset = 0;
-        std::string new_content = content_str;
-        bool matched = false;
-        int offset = 0;
-        size_t cur_start = 0;
-
-        for (size_t length : line_lengths) {
-            // Build match string (replace previous newline with \n for MULTILINE)
-            std::string match_str = content_str;
-            if (cur_start > 0) {
-                // Replace previous newline char with '\n'
-                match_str = content_str.substr(0, cur_start - 1) + "\n" + content_str.substr(cur_start);
+        // Substitutions of this rule, as edits against content_str
+        EditList edits;
+
+        if (rules.plain_group(rule_index) != std::string::npos) {
+            // Plain string: one scan finds the occurrences of all literals of the group
+            const AhoCorasick& automaton = rules.plain_literals(rules.plain_group(rule_index));
+            if (plain_group != rules.plain_group(rule_index)) {
+                plain_occurrences.assign(automaton.pattern_count(), {});
+                automaton.scan(content_str, 0, content_str.size(), [&](uint32_t id, size_t end) {
+                    plain_occurrences[id].push_back(end - automaton.pattern_length(id));
+                    return true;
+                });
+                plain_group = rules.plain_group(rule_index);
             }
+            size_t id = rules.plain_literal_id(rule_index);
+            size_t length = automaton.pattern_length(id);
+            // Same as the regex: leftmost non-overlapping occurrences within each line,
+            // none in lines that are not valid UTF-8
+            size_t next_free = 0;
+            for (size_t abs_start : plain_occurrences[id]) {
+                size_t abs_end = abs_start + length;
+                if (abs_start < next_free) continue;
+                size_t line = lines.line_of(abs_start);
+                if (abs_end > lines.line_end(line)) continue;
+                if (line_utf8[line] == 0) {
+                    line_utf8[line] = string_utils::is_valid_utf8(content_str.data() + lines.line_start(line),
+                                                                  lines.line_length(line)) ? 1 : 2;
+                }
+                if (line_utf8[line] != 1) continue;
+                next_free = abs_end;
 
-            try {
-                // Use PCRE2 for matching within the line range
-                auto pcre_matches = pcre2_regex::finditer(
-                    rule.match_pattern, match_str, cur_start, cur_start + length);
-
-                for (const auto& pm : pcre_matches) {
-                    size_t abs_start = pm.start;
-                    size_t abs_end = pm.end;
-                    size_t match_len = abs_end - abs_start;
-
-                    // Check endmatchhere: find line boundaries
-                    size_t line_start = abs_start;
-                    for (size_t pos = abs_start; pos > 0; pos--) {
-                        bool is_newline = false;
-                        for (const auto& nl : globalvar::newlines) {
-                            if (pos >= nl.size() && content_str.substr(pos - nl.size(), nl.size()) == nl) {
-                                is_newline = true;
-                                break;
-                            }
+                if (blocked_by_end_match(abs_start, abs_end)) continue;
+                edits.add(abs_start, length, rule.substitute_pattern);
+            }
+        } else {
+            // Combined rules: one scan of each line finds the lines each rule of the file may match
+            const std::vector<size_t>* candidates = nullptr;
+            size_t group = rules.regex_group(rule_index);
+            if (group != std::string::npos) {
+                if (regex_group != group) {
+                    const auto& set = rules.regex_patterns(group);
+                    candidate_lines.assign(set.size(), {});
+                    std::vector<bool> found;
+                    for (size_t line = 0; line < lines.size(); line++) {
+                        bool complete = set.find_matching(content_str, lines.line_start(line), lines.line_end(line), found);
+                        for (size_t m = 0; m < set.size(); m++) {
+                            if (!complete || found[m]) candidate_lines[m].push_back(line);
                         }
-                        if (is_newline) break;
-                        line_start = pos - 1;
                     }
+                    regex_group = group;
+                }
+                candidates = &candidate_lines[rules.regex_member(rule_index)];
+            }
 
-                    size_t line_end = abs_end;
-                    for (size_t pos = abs_end; pos < content_str.size(); pos++) {
-                        line_end = pos + 1;
-                        bool is_newline = false;
-                        for (const auto& nl : globalvar::newlines) {
-                            if (pos + nl.size() <= content_str.size() &&
-                                content_str.substr(pos, nl.size()) == nl) {
-                                is_newline = true;
-                                line_end = pos + nl.size();
-                                break;
-                            }
+            const std::string& subject = match_visible ? visible->text() : content_str;
+            const LineIndex& subject_lines = match_visible ? *visible_lines : lines;
+            // Multiline rules match the whole content, others each line separately
+            size_t range_count = rule.match_is_multiline ? 1 : candidates ? candidates->size() : subject_lines.size();
+
+            // What is left of the budget bounds each match of this rule
+            const double rule_cpu_start = thread_cpu_seconds();
+            auto remaining = std::chrono::duration<double>(deadline - clock::now()).count();
+            if (remaining <= 0) return time_out(rule_index, rule_cpu_start);
+            pcre2_regex::set_match_limits(
+                static_cast<uint32_t>(std::min(remaining * globalvar::output_subst_match_limit_per_second, 4e9)) + 1,
+                globalvar::output_subst_heap_limit_kib);
+
+            for (size_t candidate = 0; candidate < range_count; candidate++) {
+                size_t range = candidates ? (*candidates)[candidate] : candidate;
+                size_t range_start = rule.match_is_multiline ? 0 : subject_lines.line_start(range);
+                size_t range_end = rule.match_is_multiline ? subject.size() : subject_lines.line_end(range);
+                if (clock::now() >= deadline) return time_out(rule_index, rule_cpu_start);
+
+                // Match within the range of the original buffer
+                try {
+                    // The first line of a continued line does not start at its start
+                    uint32_t options = continues_line && range_start == 0 ? PCRE2_NOTBOL : 0;
+                    pcre2_regex::MatchCursor cursor(*pattern, subject, range_start, range_end, options);
+                    while (cursor.next()) {
+                        const auto& pm = cursor.match();
+                        size_t abs_start = pm.start(), abs_end = pm.end();
+                        // A match in the visible text covers the raw runs between its escapes
+                        std::vector<VisibleText::Range> raw_ranges;
+                        if (match_visible) {
+                            raw_ranges = visible->raw_ranges(pm.start(), pm.end());
+                            abs_start = raw_ranges.front().offset;
+                            abs_end = raw_ranges.back().offset + raw_ranges.back().length;
                         }
-                        if (is_newline) break;
-                    }
+                        if (blocked_by_end_match(abs_start, abs_end)) continue;
 
-                    // Check if any 0x02 in the line range of condition_map
-                    bool skip = false;
-                    for (size_t i = line_start; i < std::min(line_end, condition_map.size()); i++) {
-                        if (condition_map[i] == 0x02) { skip = true; break; }
-                    }
-                    if (skip) continue;
-                    matched = true;
-
-                    // Perform substitution
-                    std::string new_str;
-                    if (rule.is_regex) {
-                        new_str = pcre2_regex::expand_replacement(rule.substitute_pattern, pm);
-                    } else {
-                        new_str = rule.substitute_pattern;
+                        // Record the substitution
+                        std::string new_str;
+                        if (rule.is_regex) {
+                            pcre2_regex::expand_replacement(rule.substitute_pattern, pm, new_str);
+                        } else {
+                            new_str = rule.substitute_pattern;
+                        }
+                        if (match_visible) {
+                            add_visible_edits(edits, raw_ranges, std::move(new_str));
+                        } else {
+                            edits.add(pm.start(), pm.end() - pm.start(), std::move(new_str));
+                        }
                     }
-
-                    size_t pos_in_new = abs_start + offset;
-                    new_content = new_content.substr(0, pos_in_new) + new_str +
-                                  new_content.substr(pos_in_new + match_len);
-                    offset += static_cast<int>(new_str.size()) - static_cast<int>(match_len);
-
-                    // Update condition map
-                    uint8_t mark = rule.end_match_here ? 0x02 : 0x01;
-                    std::vector<uint8_t> sub_map(new_str.size(), mark);
-                    size_t cm_pos = abs_start + new_condition_map_offset;
-                    new_condition_map.erase(
-                        new_condition_map.begin() + cm_pos,
-                        new_condition_map.begin() + cm_pos + match_len);
-                    new_condition_map.insert(
-                        new_condition_map.begin() + cm_pos,
-                        sub_map.begin(), sub_map.end());
-                    new_condition_map_offset += static_cast<int>(new_str.size()) - static_cast<int>(match_len);
+                } catch (const pcre2_regex::match_limit_error& e) {
+                    // Matches already recorded are dropped along with the rest of the pass. The match
+                    // limit counts matching steps: a rule that ran out of a limit worth a good part of
+                    // the budget did that much work itself, however long the thread was stopped.
+                    return time_out(rule_index, rule_cpu_start,
+                                    !e.is_match_limit() || remaining >= globalvar::output_subst_slow_rule_cpu_time);
                 }
-            } catch (const pcre2_regex::regex_error&) {
-                // Skip invalid patterns
             }
-
-            cur_start += length;
         }
 
-        content_str = new_content;
-        condition_map = new_condition_map;
-        if (matched) encountered_ids.insert(rule.unique_id);
+        if (!edits.empty()) {
+            // Update condition map and content in one pass each
+            condition_map.apply(edits, rule.end_match_here);
+            if (!substituted) {
+                original = std::move(content_str);
+                content_str = edits.apply(original);
+                substituted = true;
+            } else {
+                content_str = edits.apply(content_str);
+            }
+            lines = LineIndex(content_str);
+            line_utf8.assign(lines.size(), 0);
+            literals_scanned = false;
+            visible.reset();
+            visible_lines.reset();
+            visible_literals_scanned = false;
+            plain_group = std::string::npos;
+            regex_group = std::string::npos;
+            encountered_ids.insert(rule.unique_id);
+        }
     }
 
-    // Determine changed line indices
+    pcre2_regex::reset_match_limits();
+
+    // Determine changed line indices: every line touched by a substituted range
     std::set<int> changed_line_indices;
-    std::regex lm_re(line_match_pattern);
-    std::vector<size_t> final_line_lengths;
-    {
-        auto it = std::sregex_iterator(content_str.begin(), content_str.end(), lm_re);
-        auto end = std::sregex_iterator();
-        for (; it != end; ++it) {
-            if (it->length() > 0) final_line_lengths.push_back(it->length());
+    for (const auto* intervals : {&condition_map.matched(), &condition_map.end_match()}) {
+        for (const auto& iv : *intervals) {
+            size_t first = lines.line_of(iv.start);
+            size_t last = lines.line_of(iv.end - 1);
+            for (size_t x = first; x <= last; x++) changed_line_indices.insert(static_cast<int>(x));
         }
     }
-    size_t cur_start = 0;
-    for (size_t x = 0; x < final_line_lengths.size(); x++) {
-        size_t length = final_line_lengths[x];
-        for (size_t i = cur_start; i < std::min(cur_start + length, condition_map.size()); i++) {
-            if (condition_map[i] == 0x01 || condition_map[i] == 0x02) {
-                changed_line_indices.insert(static_cast<int>(x));
-                break;
-            }
+
+    return {content_str, changed_line_indices};
+}
+
+size_t decided_length(const std::string& content, const RuleSet& rules, size_t window) {
+    if (content.size() <= window) return content.size();
+    // Search the window from a character boundary on
+    size_t search_start = content.size() - window;
+    while (search_start < content.size() && (static_cast<unsigned char>(content[search_start]) & 0xc0) == 0x80) {
+        search_start++;
+    }
+    size_t cut = content.size();
+    // Plain-string rules: the automaton state at the end tells the longest partial match of a group
+    for (size_t group = 0; group < rules.plain_group_count() && cut > search_start; group++) {
+        cut = std::min(cut, content.size() - rules.plain_literals(group).prefix_suffix_length(
+                                                  content, search_start, content.size()));
+    }
+    // Regex rules: PCRE2 partial matching, within the same kind of budget as match_content
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(globalvar::output_subst_timeout));
+    for (size_t i = 0; i < rules.size() && cut > search_start; i++) {
+        if (!rules.pattern(i) || rules.is_slow(i) || rules.plain_group(i) != std::string::npos) continue;
+        auto remaining = std::chrono::duration<double>(deadline - clock::now()).count();
+        // Out of time: the rules left could match anywhere in the window
+        if (remaining <= 0) {
+            cut = search_start;
+            break;
         }
-        cur_start += length;
+        pcre2_regex::set_match_limits(
+            static_cast<uint32_t>(std::min(remaining * globalvar::output_subst_match_limit_per_second, 4e9)) + 1,
+            globalvar::output_subst_heap_limit_kib);
+        auto start = pcre2_regex::partial_match_start(*rules.pattern(i), content, search_start);
+        // Undecided: the rule could match anywhere in the window
+        cut = std::min(cut, start ? *start : search_start);
+    }
+    pcre2_regex::reset_match_limits();
+    // Do not split a UTF-8 character: a cut inside one, or at the end of content (where the
+    // last one may be incomplete), moves back to its lead byte
+    auto byte = [&](size_t pos) { return static_cast<unsigned char>(content[pos]); };
+    if (cut == content.size() || (byte(cut) & 0xc0) == 0x80) {
+        size_t lead = cut;
+        while (lead > search_start && (byte(lead - 1) & 0xc0) == 0x80) lead--;
+        if (lead > search_start && byte(lead - 1) >= 0xc0) cut = lead - 1;
     }
+    return cut;
+}
 
-    return {content_str, changed_line_indices};
+std::pair<std::string, std::set<int>> match_content(
+    const std::string& content,
+    const std::optional<std::string>& command,
+    bool is_stderr
+) {
+    return match_content(content, RuleSet(command, is_stderr));
 }
 
 } // namespace substrules_processor
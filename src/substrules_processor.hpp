@@ -1,14 +1,39 @@
 #pragma once
+#include "globalvar.hpp"
 #include <string>
 #include <set>
 #include <optional>
 #include <utility>
 
 namespace clitheme {
+
+class RuleSet;
+
 namespace substrules_processor {
 
-// Match content against substitution rules from the database
+// Match content against a pre-loaded, pre-filtered set of substitution rules
 // Returns: (processed_content, set of changed line indices)
+// Pass content as an rvalue to avoid a copy; without matches it is returned unchanged.
+// foreground_only rules are skipped unless child_in_foreground. With continues_line, content
+// continues a line of the previous chunk, so ^ does not match at its start.
+std::pair<std::string, std::set<int>> match_content(
+    std::string content,
+    const RuleSet& rules,
+    bool child_in_foreground = true,
+    bool continues_line = false
+);
+
+// Where to cut content that has to be processed before its line is complete (a full
+// buffer): the start of the leftmost place in the last window bytes where a rule could
+// still match if more output followed (PCRE2 partial match; for plain-string rules the
+// longest end that is the start of one of their strings), so that no match is split.
+// A rule whose partial match cannot be decided (resource or time limit) counts as matching
+// from the start of the window. At least content.size() - window, at a UTF-8 character boundary.
+size_t decided_length(const std::string& content, const RuleSet& rules,
+                      size_t window = globalvar::exec_undecided_tail_cap);
+
+// Match content against substitution rules from the database
+// Loads the rules on every call; prefer the RuleSet overload for repeated calls
 std::pair<std::string, std::set<int>> match_content(
     const std::string& content,
     const std::optional<std::string>& command = std::nullopt,
@@ -0,0 +1,21 @@
+#include "terminal_state.hpp"
+#include <termios.h>
+#include <unistd.h>
+
+namespace clitheme {
+
+TerminalState::TerminalState(int terminal_fd, pid_t child_pgid)
+    : terminal_fd_(terminal_fd), child_pgid_(child_pgid), foreground_(true) {}
+
+bool TerminalState::is_raw() const {
+    struct termios mode;
+    return tcgetattr(terminal_fd_, &mode) == 0 && !(mode.c_lflag & ICANON);
+}
+
+void TerminalState::refresh() {
+    // 0 or an error while the child is still setting up its session: keep the last value
+    pid_t foreground = tcgetpgrp(terminal_fd_);
+    if (foreground > 0) foreground_.store(foreground == child_pgid_, std::memory_order_relaxed);
+}
+
+} // namespace clitheme
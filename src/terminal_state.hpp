@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+#include <sys/types.h>
+
+namespace clitheme {
+
+// What output processing needs to know about the child's terminal, read from the
+// pty master: whether the program on it reads raw input, and whether the command's
+// own process group is in the foreground (for foreground_only rules).
+// The foreground group is cached; refresh() re-reads it (on read events and SIGCHLD).
+class TerminalState {
+public:
+    // child_pgid: process group of the command (a session leader's pid)
+    TerminalState(int terminal_fd, pid_t child_pgid);
+
+    // Whether the terminal is in non-canonical (raw) mode
+    bool is_raw() const;
+    // Re-read the foreground process group; async-signal-safe
+    void refresh();
+    // Whether the command's process group was in the foreground at the last refresh
+    bool child_in_foreground() const { return foreground_.load(std::memory_order_relaxed); }
+
+private:
+    int terminal_fd_;
+    pid_t child_pgid_;
+    std::atomic<bool> foreground_;
+};
+
+} // namespace clitheme
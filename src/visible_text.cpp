@@ -0,0 +1,83 @@
+#include "visible_text.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace clitheme {
+
+// Length of the escape sequence starting with the ESC at raw[pos]
+static size_t escape_length(const std::string& raw, size_t pos) {
+    size_t end = raw.size();
+    size_t i = pos + 1;
+    if (i >= end) return end - pos;
+    char kind = raw[i++];
+    if (kind == '[') {
+        // CSI: parameter bytes, intermediate bytes, final byte
+        while (i < end && raw[i] >= 0x30 && raw[i] <= 0x3f) i++;
+        while (i < end && raw[i] >= 0x20 && raw[i] <= 0x2f) i++;
+        if (i < end && raw[i] >= 0x40 && raw[i] <= 0x7e) i++;
+        return i - pos;
+    }
+    if (kind == ']' || kind == 'P' || kind == '^' || kind == '_' || kind == 'X') {
+        // OSC, DCS, PM, APC, SOS: a string ended by ST (ESC \) or, for OSC, BEL
+        for (; i < end; i++) {
+            if (raw[i] == '\a' && kind == ']') return i + 1 - pos;
+            if (raw[i] == '\x1b' && i + 1 < end && raw[i + 1] == '\\') return i + 2 - pos;
+        }
+        return end - pos;
+    }
+    // Other sequences: intermediate bytes, then a final byte
+    i--;
+    while (i < end && raw[i] >= 0x20 && raw[i] <= 0x2f) i++;
+    if (i < end && raw[i] >= 0x30 && raw[i] <= 0x7e) i++;
+    return i - pos;
+}
+
+VisibleText::VisibleText(const std::string& raw) {
+    const char* data = raw.data();
+    const void* esc = memchr(data, '\x1b', raw.size());
+    if (!esc) {
+        text_ = raw;
+        return;
+    }
+    text_.reserve(raw.size());
+    size_t pos = 0;
+    size_t shift = 0;
+    while (esc) {
+        size_t start = static_cast<const char*>(esc) - data;
+        text_.append(data + pos, start - pos);
+        size_t length = escape_length(raw, start);
+        shift += length;
+        // Consecutive escapes share one entry
+        if (!escapes_.empty() && escapes_.back().visible == text_.size()) {
+            escapes_.back().shift = shift;
+        } else {
+            escapes_.push_back({text_.size(), shift});
+        }
+        pos = start + length;
+        esc = pos < raw.size() ? memchr(data + pos, '\x1b', raw.size() - pos) : nullptr;
+    }
+    text_.append(data + pos, raw.size() - pos);
+}
+
+size_t VisibleText::raw_offset(size_t visible) const {
+    // Last escape at or before visible
+    auto it = std::upper_bound(escapes_.begin(), escapes_.end(), visible,
+        [](size_t v, const Escape& e) { return v < e.visible; });
+    return visible + (it == escapes_.begin() ? 0 : std::prev(it)->shift);
+}
+
+std::vector<VisibleText::Range> VisibleText::raw_ranges(size_t begin, size_t end) const {
+    std::vector<Range> ranges;
+    size_t run_start = begin;
+    // Escapes strictly inside (begin, end) split the range
+    auto it = std::upper_bound(escapes_.begin(), escapes_.end(), begin,
+        [](size_t v, const Escape& e) { return v < e.visible; });
+    for (; it != escapes_.end() && it->visible < end; ++it) {
+        ranges.push_back({raw_offset(run_start), it->visible - run_start});
+        run_start = it->visible;
+    }
+    ranges.push_back({raw_offset(run_start), end - run_start});
+    return ranges;
+}
+
+} // namespace clitheme
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace clitheme {
+
+// Visible text of a chunk of output: the chunk without its terminal escape
+// sequences (CSI such as SGR colors, OSC such as hyperlinks, DCS/PM/APC strings
+// and other ESC sequences), built in one scan, with a map from visible offsets
+// back to the raw chunk. An escape sequence cut off at the end of the chunk is
+// left out up to the end.
+class VisibleText {
+public:
+    // A range of the raw chunk
+    struct Range {
+        size_t offset;
+        size_t length;
+    };
+
+    explicit VisibleText(const std::string& raw);
+
+    const std::string& text() const { return text_; }
+    // Whether the raw chunk contains escape sequences (otherwise text() equals it)
+    bool has_escapes() const { return !escapes_.empty(); }
+
+    // Raw offset of visible offset visible (past any escapes just before it)
+    size_t raw_offset(size_t visible) const;
+    // Raw ranges of the visible bytes [begin, end), in order: one per run of bytes
+    // between escape sequences. An empty range gives one empty raw range.
+    std::vector<Range> raw_ranges(size_t begin, size_t end) const;
+
+private:
+    // Escape sequences before visible offset `visible` add up to `shift` raw bytes
+    struct Escape {
+        size_t visible;
+        size_t shift;
+    };
+
+    std::string text_;
+    std::vector<Escape> escapes_;
+};
+
+} // namespace clitheme